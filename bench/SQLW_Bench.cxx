@@ -0,0 +1,239 @@
+
+#include "rapidjson/document.h"
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
+
+#include "Database.h"
+#include "Query.h"
+#include "QueryPool.h"
+#include "Metrics.h"
+
+#include "CON.h"
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <random>
+#include <functional>
+#include <cstdlib>
+
+
+/*
+ * Measures the throughput and latency of the library against a database built by SQLW_BenchGen.
+ *
+ *   SQLW_Bench <config file> [max threads] [seconds per run]
+ *
+ * Each benchmark is run with 1, 2, 4, ... up to the maximum number of threads. One JSON object is written
+ * to stdout per run, so results can be collected and compared between builds. Progress goes to stderr.
+ */
+
+
+using namespace SQLW;
+
+
+// A single operation. Returns false if it failed
+typedef std::function< bool( Database&, std::minstd_rand& ) > Operation;
+
+
+// Number of records in the database when the benchmark started
+int64_t record_count = 0;
+
+// Next id to insert. Starts after the generated records
+std::atomic< int64_t > next_insert( 0 );
+
+
+bool pointRead( Database& db, std::minstd_rand& generator )
+{
+  rapidjson::Document request( rapidjson::kObjectType );
+  request.AddMember( "id", (int64_t)( generator() % record_count ), request.GetAllocator() );
+
+  rapidjson::Document response = executeJson( db, "point_read", request );
+  return response["success"].GetBool() && response["data"].Size() == 1;
+}
+
+
+bool scan( Database& db, std::minstd_rand& generator )
+{
+  rapidjson::Document request( rapidjson::kObjectType );
+  request.AddMember( "id", (int64_t)( generator() % record_count ), request.GetAllocator() );
+
+  rapidjson::Document response = executeJson( db, "scan", request );
+  return response["success"].GetBool();
+}
+
+
+bool insert( Database& db, std::minstd_rand& generator )
+{
+  static const std::string payload( 100, 'x' );
+
+  rapidjson::Document request( rapidjson::kObjectType );
+  rapidjson::Document::AllocatorType& alloc = request.GetAllocator();
+  request.AddMember( "id", next_insert.fetch_add( 1 ), alloc );
+  request.AddMember( "category", (int64_t)( generator() % 100 ), alloc );
+  request.AddMember( "name", "bench", alloc );
+  request.AddMember( "payload", rapidjson::Value( payload.c_str(), alloc ), alloc );
+
+  rapidjson::Document response = executeJson( db, "insert", request );
+  return response["success"].GetBool();
+}
+
+
+// The point read through the manual interface, without any JSON
+bool rawRead( Database& db, std::minstd_rand& generator )
+{
+  static QueryPool& pool = db.requestPool( "point_read" );
+
+  Query::LockType lock = pool.checkout();
+  Query& query = *lock.mutex();
+
+  query.getParameter( 0 ).set( (int64_t)( generator() % record_count ) );
+
+  query.prepare();
+  size_t rows = 0;
+  while ( query.step() )
+  {
+    rows += 1;
+  }
+  query.reset();
+
+  return ! query.error() && rows == 1;
+}
+
+
+// Run an operation on a number of threads for a time and print the results
+void run( Database& db, const char* name, const Operation& operation, unsigned int threads, double seconds )
+{
+  Histogram latency;
+  std::atomic< uint64_t > errors( 0 );
+
+  const QueryMetrics::Clock::time_point start = QueryMetrics::Clock::now();
+  const QueryMetrics::Clock::time_point end = start + std::chrono::duration_cast< QueryMetrics::Clock::duration >( std::chrono::duration< double >( seconds ) );
+
+  std::vector< std::thread > workers;
+  for ( unsigned int t = 0; t < threads; ++t )
+  {
+    workers.push_back( std::thread( [&, t]()
+      {
+        std::minstd_rand generator( t + 1 );
+        while ( QueryMetrics::Clock::now() < end )
+        {
+          QueryMetrics::Clock::time_point op_start = QueryMetrics::Clock::now();
+          if ( ! operation( db, generator ) )
+          {
+            errors.fetch_add( 1, std::memory_order_relaxed );
+          }
+          latency.record( QueryMetrics::since( op_start ) );
+        }
+      } ) );
+  }
+
+  for ( std::vector< std::thread >::iterator it = workers.begin(); it != workers.end(); ++it )
+  {
+    it->join();
+  }
+
+  double elapsed = QueryMetrics::since( start ) * 1.0e-9;
+
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer< rapidjson::StringBuffer > writer( buffer );
+
+  writer.StartObject();
+  writer.Key( "benchmark" );
+  writer.String( name );
+  writer.Key( "threads" );
+  writer.Uint( threads );
+  writer.Key( "records" );
+  writer.Int64( record_count );
+  writer.Key( "operations" );
+  writer.Uint64( latency.count() );
+  writer.Key( "errors" );
+  writer.Uint64( errors.load() );
+  writer.Key( "seconds" );
+  writer.Double( elapsed );
+  writer.Key( "ops_per_second" );
+  writer.Double( latency.count() / elapsed );
+  writer.Key( "mean_ns" );
+  writer.Uint64( latency.mean() );
+  writer.Key( "p50_ns" );
+  writer.Uint64( latency.percentile( 0.50 ) );
+  writer.Key( "p90_ns" );
+  writer.Uint64( latency.percentile( 0.90 ) );
+  writer.Key( "p99_ns" );
+  writer.Uint64( latency.percentile( 0.99 ) );
+  writer.Key( "max_ns" );
+  writer.Uint64( latency.max() );
+  writer.Key( "sqlite_version" );
+  writer.String( sqlite3_libversion() );
+  writer.EndObject();
+
+  std::cout << buffer.GetString() << std::endl;
+  std::cerr << name << " x " << threads << " : " << (uint64_t)( latency.count() / elapsed ) << " ops/s" << std::endl;
+}
+
+
+int main( int argc, char** argv )
+{
+  if ( argc < 2 )
+  {
+    std::cerr << "Usage: " << argv[0] << " <config file> [max threads] [seconds per run]" << std::endl;
+    return 1;
+  }
+
+  unsigned int max_threads = ( argc > 2 ) ? std::atoi( argv[2] ) : std::thread::hardware_concurrency();
+  double seconds = ( argc > 3 ) ? std::atof( argv[3] ) : 2.0;
+
+  if ( max_threads == 0 ) max_threads = 1;
+
+  try
+  {
+    CON::Object root = CON::buildFromFile( argv[1] );
+
+    Database db( root );
+
+    rapidjson::Document request( rapidjson::kObjectType );
+    rapidjson::Document response = executeJson( db, "count", request );
+    record_count = response["data"][0]["count"].GetInt64();
+    next_insert = record_count;
+
+    if ( record_count == 0 )
+    {
+      std::cerr << "The database is empty. Run SQLW_BenchGen first." << std::endl;
+      return 1;
+    }
+
+    const char* names[] = { "point_read", "scan", "raw_point_read", "insert" };
+    Operation operations[] = { pointRead, scan, rawRead, insert };
+
+    for ( size_t b = 0; b < 4; ++b )
+    {
+      for ( unsigned int threads = 1; ; threads *= 2 )
+      {
+        if ( threads > max_threads )
+          threads = max_threads;
+
+        run( db, names[b], operations[b], threads, seconds );
+
+        if ( threads == max_threads )
+          break;
+      }
+    }
+  }
+  catch( CON::Exception& ex )
+  {
+    std::cerr << "CON Exception Caught: " << ex.what() << '\n';
+    for ( CON::Exception::iterator it = ex.begin(); it != ex.end(); ++it )
+    {
+      std::cerr << *it << std::endl;
+    }
+    return 1;
+  }
+  catch ( std::exception& ex )
+  {
+    std::cerr << "Unexpected exception occured: " << ex.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
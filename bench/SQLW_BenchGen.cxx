@@ -0,0 +1,105 @@
+
+#include "sqlite3.h"
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+
+
+/*
+ * Builds a synthetic database for the benchmarks.
+ *
+ *   SQLW_BenchGen <file> [rows] [payload width]
+ *
+ * Any existing file is replaced. Rows are generated from a fixed seed so every run produces the same database.
+ */
+
+
+// Run a statement, exiting on failure
+void execute( sqlite3* database, const char* statement )
+{
+  char* error = nullptr;
+  if ( sqlite3_exec( database, statement, nullptr, nullptr, &error ) != SQLITE_OK )
+  {
+    std::cerr << "Failed to run: " << statement << " : " << error << std::endl;
+    sqlite3_free( error );
+    std::exit( 1 );
+  }
+}
+
+
+int main( int argc, char** argv )
+{
+  if ( argc < 2 )
+  {
+    std::cerr << "Usage: " << argv[0] << " <file> [rows] [payload width]" << std::endl;
+    return 1;
+  }
+
+  const std::string filename = argv[1];
+  const long rows = ( argc > 2 ) ? std::atol( argv[2] ) : 1000000;
+  const long width = ( argc > 3 ) ? std::atol( argv[3] ) : 100;
+
+  std::remove( filename.c_str() );
+  std::remove( ( filename + "-wal" ).c_str() );
+  std::remove( ( filename + "-shm" ).c_str() );
+
+  sqlite3* database = nullptr;
+  if ( sqlite3_open( filename.c_str(), &database ) != SQLITE_OK )
+  {
+    std::cerr << "Failed to create " << filename << " : " << sqlite3_errmsg( database ) << std::endl;
+    return 1;
+  }
+
+  execute( database, "PRAGMA journal_mode=WAL;" );
+  execute( database, "PRAGMA synchronous=OFF;" );
+  execute( database, "CREATE TABLE Records( Id INTEGER PRIMARY KEY, Category INTEGER NOT NULL, Name TEXT NOT NULL, Payload TEXT NOT NULL );" );
+
+  sqlite3_stmt* statement = nullptr;
+  sqlite3_prepare_v2( database, "INSERT INTO Records( Id, Category, Name, Payload ) VALUES ( ?, ?, ?, ? );", -1, &statement, nullptr );
+
+  std::minstd_rand generator( 42 );
+  std::string name;
+  std::string payload( width, ' ' );
+
+  execute( database, "BEGIN;" );
+  for ( long i = 0; i < rows; ++i )
+  {
+    name = "record-" + std::to_string( i );
+    for ( long c = 0; c < width; ++c )
+    {
+      payload[c] = 'a' + generator() % 26;
+    }
+
+    sqlite3_bind_int64( statement, 1, i );
+    sqlite3_bind_int64( statement, 2, generator() % 100 );
+    sqlite3_bind_text( statement, 3, name.c_str(), name.size(), SQLITE_STATIC );
+    sqlite3_bind_text( statement, 4, payload.c_str(), payload.size(), SQLITE_STATIC );
+
+    if ( sqlite3_step( statement ) != SQLITE_DONE )
+    {
+      std::cerr << "Failed to insert row " << i << " : " << sqlite3_errmsg( database ) << std::endl;
+      return 1;
+    }
+    sqlite3_reset( statement );
+
+    // Keep the transactions a sensible size
+    if ( i % 100000 == 99999 )
+    {
+      execute( database, "COMMIT;" );
+      execute( database, "BEGIN;" );
+    }
+  }
+  execute( database, "COMMIT;" );
+
+  sqlite3_finalize( statement );
+  execute( database, "PRAGMA wal_checkpoint(TRUNCATE);" );
+  sqlite3_close( database );
+
+  std::cerr << "Generated " << rows << " rows of " << width << " bytes in " << filename << std::endl;
+
+  return 0;
+}
+
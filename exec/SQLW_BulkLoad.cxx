@@ -0,0 +1,141 @@
+
+#include "Database.h"
+#include "BulkLoader.h"
+
+#include "CON.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+
+
+/*
+ * Loads a file of records into a database through a named insert query from its configuration.
+ *
+ *   SQLW_BulkLoad <config> <query> <file> [options]
+ *
+ *   --format ndjson|csv       The layout of the file. Otherwise files ending in .csv are CSV, and anything else NDJSON
+ *   --transaction-rows N      Rows committed in each transaction (default 50000)
+ *   --rows-per-statement N    Rows inserted by each statement (default 1)
+ *   --no-header               The CSV file has no header line, so its columns are the query's parameters in order
+ *
+ * Progress is printed to stderr every second. Configure the "bulk_load" performance preset for the fastest loads.
+ */
+
+
+using namespace SQLW;
+
+
+void usage( const char* program )
+{
+  std::cerr << "Usage: " << program << " <config> <query> <file> [--format ndjson|csv] [--transaction-rows N]"
+            << " [--rows-per-statement N] [--no-header]" << std::endl;
+}
+
+
+void printProgress( const BulkLoader::Progress& progress, const char* end )
+{
+  std::cerr << "\rRows: " << progress.rows << "  Rejected: " << progress.rejected
+            << "  MB: " << std::fixed << std::setprecision( 1 ) << progress.bytes / 1048576.0
+            << "  Rows/s: " << std::setprecision( 0 ) << progress.rowsPerSecond() << "    " << end << std::flush;
+}
+
+
+int main( int argc, char** argv )
+{
+  if ( argc < 4 )
+  {
+    usage( argv[0] );
+    return 1;
+  }
+
+  const std::string config_file = argv[1];
+  const std::string query_name = argv[2];
+  const std::string filename = argv[3];
+
+  BulkLoader::Format format = BulkLoader::NDJSON;
+  if ( filename.size() >= 4 && filename.compare( filename.size() - 4, 4, ".csv" ) == 0 )
+  {
+    format = BulkLoader::CSV;
+  }
+
+  BulkLoader::Options options;
+  options.progress = []( const BulkLoader::Progress& progress ) { printProgress( progress, "" ); };
+
+  for ( int i = 4; i < argc; ++i )
+  {
+    const std::string option = argv[i];
+    const bool has_value = ( i + 1 < argc );
+
+    if ( option == "--format" && has_value )
+    {
+      const std::string value = argv[++i];
+      if ( value == "csv" )
+        format = BulkLoader::CSV;
+      else if ( value == "ndjson" )
+        format = BulkLoader::NDJSON;
+      else
+      {
+        std::cerr << "Unknown format: " << value << ". Expected ndjson or csv" << std::endl;
+        return 1;
+      }
+    }
+    else if ( option == "--transaction-rows" && has_value )
+    {
+      options.transactionRows = std::atol( argv[++i] );
+    }
+    else if ( option == "--rows-per-statement" && has_value )
+    {
+      options.rowsPerStatement = std::atol( argv[++i] );
+    }
+    else if ( option == "--no-header" )
+    {
+      options.header = false;
+    }
+    else
+    {
+      usage( argv[0] );
+      return 1;
+    }
+  }
+
+  try
+  {
+    CON::Object root = CON::buildFromFile( config_file );
+
+    Database db( root );
+    BulkLoader loader( db, query_name.c_str(), options );
+
+    if ( options.rowsPerStatement > 1 )
+    {
+      std::cerr << "Inserting " << loader.rowsPerStatement() << " rows per statement" << std::endl;
+    }
+
+    BulkLoader::Progress progress = loader.load( filename, format );
+
+    printProgress( progress, "\n" );
+    std::cerr << "Loaded " << progress.rows << " rows in " << std::setprecision( 2 ) << progress.seconds << "s" << std::endl;
+
+    return progress.rejected == 0 ? 0 : 2;
+  }
+  catch( CON::Exception& ex )
+  {
+    std::cerr << "CON Exception Caught: " << ex.what() << '\n';
+    for ( CON::Exception::iterator it = ex.begin(); it != ex.end(); ++it )
+    {
+      std::cerr << *it << std::endl;
+    }
+  }
+  catch( std::runtime_error& ex )
+  {
+    std::cerr << "\nBulk load failed: " << ex.what() << std::endl;
+  }
+  catch ( std::exception& ex )
+  {
+    std::cerr << "Unexpected exception occured: " << ex.what() << std::endl;
+  }
+
+  return 1;
+}
+
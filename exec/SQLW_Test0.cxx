@@ -5,15 +5,58 @@
 
 #include "Database.h"
 #include "Query.h"
+#include "QueryPool.h"
+#include "JsonStream.h"
+#include "TypedQuery.h"
+#include "BlobStream.h"
 
 #include "CON.h"
 
 #include <iostream>
+#include <vector>
+#include <string>
 
 
 using namespace SQLW;
 
 
+struct DeviceName
+{
+  int64_t index;
+  std::string name;
+};
+
+
+// Number of checks that have failed
+static int failures = 0;
+
+// Report the outcome of a check, counting the failures
+static void check( bool passed, const char* what )
+{
+  if ( passed )
+  {
+    std::cout << "PASSED: " << what << '\n';
+  }
+  else
+  {
+    std::cerr << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+// Write each row of a response as a json string, to compare responses row by row
+static void appendRows( const rapidjson::Value& data, std::vector< std::string >& rows )
+{
+  for ( rapidjson::Value::ConstValueIterator it = data.Begin(); it != data.End(); ++it )
+  {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer( buffer );
+    it->Accept( writer );
+    rows.push_back( buffer.GetString() );
+  }
+}
+
+
 int main( int, char** )
 {
   std::cout << "Testing SQLW Functionality." << std::endl;
@@ -103,6 +146,186 @@ int main( int, char** )
       std::cout << std::endl;
     }
 
+    {
+      rapidjson::Writer<rapidjson::StringBuffer> request_writer( buffer );
+      rapidjson::Document request( rapidjson::kObjectType );
+
+      request.Accept( request_writer );
+      std::cout << "REQUEST:\n" << buffer.GetString() << '\n' << std::endl;
+      buffer.Clear();
+
+      rapidjson::Writer<rapidjson::StringBuffer> response_writer( buffer );
+      executeJsonStream( db, "all_devices", request, response_writer );
+
+      std::cout << "STREAMED RESPONSE:\n" << buffer.GetString() << '\n' << std::endl;
+      buffer.Clear();
+
+      std::cout << std::endl;
+    }
+
+    {
+      TypedQuery< Params< int64_t >, Columns< int64_t, BlobView > > names( db, "device_names" );
+
+      std::vector< TypedQuery< Params< int64_t >, Columns< int64_t, BlobView > >::StoredRow > rows;
+      Status status = names.fetch( rows, 3 );
+
+      std::cout << "TYPED ROWS: " << ( status.success ? "" : status.error ) << '\n';
+      for ( const auto& row : rows )
+      {
+        std::cout << std::get< 0 >( row ) << " : " << std::get< 1 >( row ) << '\n';
+      }
+      std::cout << std::endl;
+
+      std::vector< DeviceName > devices;
+      status = names.fetchAs( devices, 3 );
+
+      std::cout << "TYPED STRUCTS: " << ( status.success ? "" : status.error ) << '\n';
+      for ( const DeviceName& device : devices )
+      {
+        std::cout << device.index << " : " << device.name << '\n';
+      }
+      std::cout << std::endl;
+    }
+
+    {
+      // Binary data with embedded nulls must come back at its full length
+      const char raw[] = "SQLW\0blob\0\0with\xff nulls\0";
+      const std::string payload( raw, sizeof( raw ) - 1 );
+
+      Query& add = db.requestQuery( "add_blob" );
+      {
+        Query::LockType lock = add.acquire();
+        add.getParameter( 0 ).set( static_cast< int64_t >( 1 ) );
+        add.getParameter( 1 ).set( payload.data(), payload.size() );
+        add.prepare();
+        while ( add.step() );
+        add.reset();
+        check( ! add.error(), "Insert blob" );
+      }
+
+      Query& get = db.requestQuery( "get_blob" );
+      {
+        Query::LockType lock = get.acquire();
+        get.getParameter( 0 ).set( static_cast< int64_t >( 1 ) );
+
+        get.prepare();
+        bool found = get.step();
+        check( found && get.getColumn( 1 ).view() == payload, "Blob read through step()" );
+        get.reset();
+
+        get.prepare();
+        found = get.stepView();
+        check( found && get.columnView( 1 ) == payload, "Blob read through columnView()" );
+        get.reset();
+      }
+
+      {
+        rapidjson::Document request( rapidjson::kObjectType );
+        request.AddMember( "index", 1, request.GetAllocator() );
+
+        rapidjson::Document response = executeJson( db, "get_blob", request );
+        const rapidjson::Value& data = response["data"];
+        check( response["success"].GetBool() && data.Size() == 1 &&
+               std::string( data[0]["bytes"].GetString(), data[0]["bytes"].GetStringLength() ) == payload,
+               "Blob read through executeJson()" );
+      }
+
+      // Reserve two blobs, then fill and read them back through a stream
+      {
+        Query::LockType lock = add.acquire();
+        for ( int64_t row = 2; row <= 3; ++row )
+        {
+          add.getParameter( 0 ).set( row );
+          add.getParameter( 1 ).bindZeroBlob( payload.size() );
+          add.prepare();
+          while ( add.step() );
+          add.reset();
+          check( ! add.error(), "Insert zero blob" );
+        }
+      }
+
+      const std::string reversed( payload.rbegin(), payload.rend() );
+      {
+        BlobStream stream = db.openBlob( "Blobs", "BlobData", 2, true );
+        const size_t half = payload.size() / 2;
+        stream.write( payload.data(), half, 0 );
+        stream.write( payload.data() + half, payload.size() - half, half );
+
+        stream.reopen( 3 );
+        stream.write( reversed.data(), reversed.size(), 0 );
+        stream.close();
+      }
+
+      {
+        BlobStream stream = db.openBlob( "Blobs", "BlobData", 2 );
+        std::string bytes( stream.size(), 'x' );
+        size_t count = stream.read( &bytes[0], bytes.size(), 0 );
+        check( count == payload.size() && bytes == payload, "BlobStream write and read" );
+
+        stream.reopen( 3 );
+        bytes.assign( stream.size(), 'x' );
+        count = stream.read( &bytes[0], bytes.size(), 0 );
+        check( count == reversed.size() && bytes == reversed, "BlobStream reopen" );
+        check( stream.read( &bytes[0], bytes.size(), bytes.size() ) == 0, "BlobStream read past the end" );
+      }
+
+      std::cout << std::endl;
+    }
+
+    {
+      // Paging through a keyset query gives the same rows as one unpaged request, the second time from the cache
+      rapidjson::Document request( rapidjson::kObjectType );
+      rapidjson::Document unpaged = executeJson( db, "all_devices", request );
+
+      std::vector< std::string > expected;
+      appendRows( unpaged["data"], expected );
+
+      size_t pages = 0;
+      for ( int run = 0; run < 2; ++run )
+      {
+        rapidjson::Document page_request( rapidjson::kObjectType );
+        page_request.AddMember( "after", -1, page_request.GetAllocator() );
+        page_request.AddMember( "count", 4, page_request.GetAllocator() );
+
+        std::vector< std::string > rows;
+        size_t count = 0;
+        bool success = true;
+        for ( ; count < expected.size() + 1; ++count )
+        {
+          rapidjson::Document response = executeJson( db, "paged_devices", page_request );
+          success = response["success"].GetBool();
+          if ( ! success )
+            break;
+
+          appendRows( response["data"], rows );
+
+          // The token stands in for the "after" parameter on the next page
+          rapidjson::Value::ConstMemberIterator next = response.FindMember( "next" );
+          if ( next == response.MemberEnd() )
+            break;
+
+          page_request.RemoveMember( "cursor" );
+          page_request.AddMember( "cursor", rapidjson::Value( next->value, page_request.GetAllocator() ), page_request.GetAllocator() );
+        }
+
+        if ( run == 0 )
+        {
+          pages = count + 1;
+          check( success && rows == expected, "Keyset pages match the unpaged rows" );
+          check( pages > 1, "Keyset query returns several pages" );
+        }
+        else
+        {
+          check( success && rows == expected, "Cached keyset pages match the unpaged rows" );
+          check( count + 1 == pages, "Cached keyset query returns the same pages" );
+        }
+      }
+
+      check( db.requestPool( "paged_devices" ).cache()->size() == pages, "Keyset pages cached once each" );
+
+      std::cout << std::endl;
+    }
+
   }
   catch( CON::Exception& ex )
   {
@@ -111,14 +334,23 @@ int main( int, char** )
     {
       std::cerr << *it << std::endl;
     }
+    ++failures;
   }
   catch( std::runtime_error& ex )
   {
     std::cerr << "Unexpected runtime error occured: " << ex.what() << std::endl;
+    ++failures;
   }
   catch ( std::exception& ex )
   {
     std::cerr << "Unexpected exception occured: " << ex.what() << std::endl;
+    ++failures;
+  }
+
+  if ( failures > 0 )
+  {
+    std::cerr << failures << " checks failed." << std::endl;
+    return 1;
   }
 
   return 0;
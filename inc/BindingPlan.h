@@ -0,0 +1,67 @@
+
+#ifndef SQLW_BINDING_PLAN_H_
+#define SQLW_BINDING_PLAN_H_
+
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <string_view>
+
+
+namespace SQLW
+{
+  class Query;
+
+
+  /*
+   * Maps the parameter names of a query to their indices, built once when the query is loaded.
+   * A request's members can then be matched to parameters in one pass with a hash lookup each,
+   * rather than searching the request for every parameter.
+   */
+  class BindingPlan
+  {
+    public:
+      // Returned when there is no parameter
+      static const size_t npos = static_cast< size_t >( -1 );
+
+    private:
+      // Hash map of name to the first parameter with it
+      typedef std::unordered_map< std::string_view, size_t > IndexMap;
+
+      // The parameter names. The map keys are views of these
+      std::vector< std::string > _names;
+
+      // Index of the first parameter with each name
+      IndexMap _index;
+
+      // Index of the next parameter with the same name, or npos. Usually there's only one
+      std::vector< size_t > _next;
+
+
+    public:
+      // Create an empty plan
+      BindingPlan();
+
+      // Not copyable, as the keys point into the names
+      BindingPlan( const BindingPlan& ) = delete;
+      BindingPlan& operator=( const BindingPlan& ) = delete;
+
+
+      // Build the plan from the parameters of a query. Every copy of the query shares it
+      void build( const Query& );
+
+
+      // Number of parameters
+      size_t size() const { return _names.size(); }
+
+      // Return the index of the first parameter with the name, or npos
+      size_t find( std::string_view ) const;
+
+      // Return the index of the next parameter with the same name as this one, or npos
+      size_t next( size_t n ) const { return _next[ n ]; }
+  };
+
+}
+
+#endif // SQLW_BINDING_PLAN_H_
+
@@ -0,0 +1,80 @@
+
+#ifndef SQLW_BLOB_STREAM_H_
+#define SQLW_BLOB_STREAM_H_
+
+#include "sqlite3.h"
+
+#include <string>
+#include <mutex>
+
+
+namespace SQLW
+{
+  struct Connection;
+
+
+  /*
+   * Incremental access to a single blob, read or written in chunks without loading it into memory.
+   * Opened with Database::openBlob. The blob's size is fixed, so reserve the space first by binding a
+   * zero-filled blob (Parameter::bindZeroBlob) when the row is inserted.
+   *
+   * The connection is locked for as long as the stream is open, so close it as soon as possible.
+   * Writes are committed when the stream is closed, unless a transaction is open on the connection.
+   */
+  class BlobStream
+  {
+    private:
+      // Lock on the connection the blob is open on
+      std::unique_lock< std::mutex > _lock;
+
+      // The connection, for its caches
+      Connection* _connection;
+
+      // The sqlite handle. Null once closed
+      sqlite3_blob* _blob;
+
+      // The table the blob belongs to
+      std::string _table;
+
+      // True if the blob can be written
+      bool _writable;
+
+
+    public:
+      // Open the blob in a column of a row, by rowid, taking over the lock on the connection. Throws on failure
+      BlobStream( Connection&, std::unique_lock< std::mutex >, const char*, const char*, int64_t, bool );
+
+      // Movable but not copyable
+      BlobStream( BlobStream&& );
+      BlobStream( const BlobStream& ) = delete;
+      BlobStream& operator=( const BlobStream& ) = delete;
+      BlobStream& operator=( BlobStream&& ) = delete;
+
+      // Closes the blob
+      ~BlobStream();
+
+
+      // Move to the same column of another row in the same table. Throws on failure
+      void reopen( int64_t );
+
+      // Close the blob and release the connection. Invalidates the caches of the table if it was written
+      void close();
+
+
+      // Return true until closed
+      bool isOpen() const { return _blob != nullptr; }
+
+      // Return the size of the blob in bytes
+      size_t size() const;
+
+      // Read up to length bytes from the offset into the buffer. Returns the number read, 0 at the end
+      size_t read( void*, size_t, size_t );
+
+      // Write length bytes from the buffer at the offset. The blob can't grow, so throws if it doesn't fit
+      void write( const void*, size_t, size_t );
+  };
+
+}
+
+#endif // SQLW_BLOB_STREAM_H_
+
@@ -0,0 +1,206 @@
+
+#ifndef SQLW_BULK_LOADER_H_
+#define SQLW_BULK_LOADER_H_
+
+#include "Query.h"
+#include "Database.h"
+
+#include "sqlite3.h"
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+
+namespace SQLW
+{
+  class QueryPool;
+
+
+  /*
+   * Streams a file of records into a named insert query.
+   *
+   * The file is memory mapped and parsed on the calling thread. A writer thread binds the parsed rows straight
+   * into the query's statement and commits them in large transactions, while the next batch is parsed.
+   * Records are matched to the query's parameters by name: the members of each line of an NDJSON file, or the
+   * columns named in the first line of a CSV file. JSON nulls and empty, unquoted CSV fields are bound as NULL.
+   * A record that is missing a parameter, has a value of the wrong type or fails to insert is rejected and counted,
+   * and loading carries on with the next.
+   *
+   * With rowsPerStatement above 1 the VALUES tuple of the statement is repeated to insert that many rows per step.
+   * The statement must end in a single VALUES ( ... ) tuple of anonymous '?' parameters, and a row that fails
+   * rejects the rest of its group.
+   */
+  class BulkLoader
+  {
+    public:
+      // The layout of the file
+      enum Format { NDJSON, CSV };
+
+      // How far a load has got
+      struct Progress
+      {
+        // Rows committed
+        uint64_t rows;
+
+        // Records rejected, either when parsed or when inserted
+        uint64_t rejected;
+
+        // Bytes of the file parsed into committed transactions
+        uint64_t bytes;
+
+        // Time since the load started
+        double seconds;
+
+        // Committed rows per second
+        double rowsPerSecond() const { return seconds > 0.0 ? rows / seconds : 0.0; }
+      };
+
+      // Called from the writer thread after a commit, at most once per report interval, and once at the end
+      typedef std::function< void( const Progress& ) > ProgressCallback;
+
+      // Tuning for a load
+      struct Options
+      {
+        // Rows committed in each transaction (default 50000)
+        size_t transactionRows;
+
+        // Rows inserted by each statement (default 1)
+        size_t rowsPerStatement;
+
+        // Whether the first line of a CSV file names the columns. Otherwise they are the parameters in order (default true)
+        bool header;
+
+        // Minimum time between progress reports (default 1s)
+        std::chrono::milliseconds reportInterval;
+
+        // Progress reports. Optional
+        ProgressCallback progress;
+
+        Options();
+      };
+
+    private:
+      // A batch of parsed rows, committed in one transaction. Defined with the implementation
+      struct Batch;
+
+      // Container type
+      typedef std::deque< Batch* > BatchQueue;
+
+      // The database and the insert query, found again by each load
+      Database& _database;
+      QueryHandle _handle;
+
+      // Version of the queries the statement and batches were built for
+      uint64_t _version;
+
+      // The insert query. Only set while a load has it pinned, and checked out for the load
+      QueryPool* _pool;
+
+      // The tuning
+      Options _options;
+
+      // The statement repeating the VALUES tuple, or null if rows are inserted one at a time
+      sqlite3_stmt* _multiStatement;
+
+      // The connection the multi-row statement was prepared on
+      Connection* _multiConnection;
+
+      // Rows inserted by the multi-row statement
+      size_t _multiRows;
+
+      // Protects the queues and the state below
+      std::mutex _mutex;
+
+      // Signals the writer that a batch is ready, or parsing has finished
+      std::condition_variable _filled;
+
+      // Signals the parser that a batch is free to fill
+      std::condition_variable _emptied;
+
+      // Batches waiting to be committed, in order
+      BatchQueue _full;
+
+      // Batches ready to be reused
+      BatchQueue _free;
+
+      // The batch the parser is filling, if any. Handed back if parsing throws
+      Batch* _parsing;
+
+      // Set once the parser has queued its last batch
+      bool _finished;
+
+      // Set if a transaction fails. Stops the load
+      std::string _failure;
+
+      // Counts reported in the progress
+      Progress _progress;
+
+      // When the current load began, and when progress was last reported
+      std::chrono::steady_clock::time_point _start;
+      std::chrono::steady_clock::time_point _lastReport;
+
+
+      // Build the multi-row statement and the batches for the query's configuration. Throws if it can't be loaded
+      void setup( QueryPool& );
+
+      // Finalise the multi-row statement and delete the batches
+      void clear();
+
+      // Writer thread main loop. Commits each full batch with the checked out query
+      void run( Query& );
+
+      // Insert a batch in a single transaction. Returns the number of rows that failed to insert.
+      // Sets the error if the transaction failed, in which case nothing was committed
+      uint64_t commit( Query&, Batch&, std::string& );
+
+      // Bind a row of a batch to a statement, starting at the given parameter
+      void bindRow( Query&, sqlite3_stmt*, const Batch&, size_t, int );
+
+      // Hand a filled batch to the writer and return an empty one. Blocks while every batch is in use
+      Batch* exchange( Batch* );
+
+      // Parse the records of a mapped file into batches. Returns the last, partly filled batch, or null if the load failed
+      Batch* parseNdjson( Query&, const char*, const char* );
+      Batch* parseCsv( Query&, const char*, const char* );
+
+      // Update the progress and report it if the interval has passed, or always if forced. Requires the mutex
+      void report( bool );
+
+
+    public:
+      // Prepare to load into the named query. Throws if the query doesn't exist or, for multi-row inserts,
+      // its statement can't be extended. Each load finds the query again, so the loader can be kept across reloads,
+      // and a reload waits for a load in progress.
+      BulkLoader( Database&, const char*, const Options& = Options() );
+
+      // Finalises the multi-row statement
+      ~BulkLoader();
+
+      // Not copyable or movable
+      BulkLoader( const BulkLoader& ) = delete;
+      BulkLoader( BulkLoader&& ) = delete;
+      BulkLoader& operator=( const BulkLoader& ) = delete;
+      BulkLoader& operator=( BulkLoader&& ) = delete;
+
+
+      // Load every record in the file. Returns the final progress.
+      // Throws if the query has been reloaded away, the file can't be read, or a transaction fails, in which case
+      // the committed rows are kept.
+      // Only one file can be loaded at a time.
+      Progress load( const std::string&, Format );
+
+
+      // Rows inserted by each statement. Can be less than requested, within sqlite's limit on parameters
+      size_t rowsPerStatement() const { return _multiRows; }
+  };
+
+}
+
+#endif // SQLW_BULK_LOADER_H_
+
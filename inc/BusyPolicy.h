@@ -0,0 +1,81 @@
+
+#ifndef SQLW_BUSY_POLICY_H_
+#define SQLW_BUSY_POLICY_H_
+
+#include "CON.h"
+
+#include <atomic>
+#include <cstdint>
+
+
+namespace SQLW
+{
+
+  /*
+   * How to retry when the database is locked by another connection or process.
+   * Waits back off exponentially from the initial delay up to the maximum, with random jitter so
+   * that competing writers don't retry in lock step. Counts the contention it sees so it can be tuned.
+   */
+  class BusyPolicy
+  {
+    private:
+      // Number of times to retry before giving up
+      unsigned int _retries;
+
+      // Delay before the first retry, in microseconds
+      unsigned int _initialDelay;
+
+      // Upper limit of the delay, in microseconds
+      unsigned int _maxDelay;
+
+      // Number of times the database was found busy
+      std::atomic< uint64_t > _busyEvents;
+
+      // Number of times the retries ran out
+      std::atomic< uint64_t > _failures;
+
+      // Total time spent waiting, in microseconds
+      std::atomic< uint64_t > _waitTime;
+
+
+    public:
+      // Default policy: 10 retries from 100us, backing off to at most 10ms
+      BusyPolicy();
+
+      // Copy the settings of another policy, overridden by any found in the configuration. Counters start at zero
+      BusyPolicy( const BusyPolicy&, const CON::Object& );
+
+      // Not copyable or movable
+      BusyPolicy( const BusyPolicy& ) = delete;
+      BusyPolicy( BusyPolicy&& ) = delete;
+      BusyPolicy& operator=( const BusyPolicy& ) = delete;
+      BusyPolicy& operator=( BusyPolicy&& ) = delete;
+
+
+      // Read "busy_retries", "busy_delay_us" and "busy_max_delay_us" from a configuration object, if present
+      void configure( const CON::Object& );
+
+      // Returns true if the configuration object overrides any of the settings
+      static bool configured( const CON::Object& );
+
+
+      // Call after a busy result, counting from zero. Sleeps before the next attempt and returns true,
+      // or returns false immediately once the retries are exhausted.
+      bool wait( unsigned int );
+
+
+      // Settings
+      unsigned int retries() const { return _retries; }
+      unsigned int initialDelay() const { return _initialDelay; }
+      unsigned int maxDelay() const { return _maxDelay; }
+
+      // Counters
+      uint64_t busyEvents() const { return _busyEvents.load( std::memory_order_relaxed ); }
+      uint64_t failures() const { return _failures.load( std::memory_order_relaxed ); }
+      uint64_t waitTime() const { return _waitTime.load( std::memory_order_relaxed ); }
+  };
+
+}
+
+#endif // SQLW_BUSY_POLICY_H_
+
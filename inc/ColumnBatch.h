@@ -0,0 +1,153 @@
+
+#ifndef SQLW_COLUMN_BATCH_H_
+#define SQLW_COLUMN_BATCH_H_
+
+#include "Parameter.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+
+// The Arrow C data interface, exactly as published by the Apache Arrow project
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+extern "C"
+{
+  struct ArrowSchema
+  {
+    // Array type description
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowSchema*);
+    // Opaque producer-specific data
+    void* private_data;
+  };
+
+  struct ArrowArray
+  {
+    // Array data description
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowArray*);
+    // Opaque producer-specific data
+    void* private_data;
+  };
+}
+
+#endif // ARROW_C_DATA_INTERFACE
+
+
+namespace SQLW
+{
+  class Query;
+
+
+  /*
+   * Column oriented buffers filled by Query::fetchBatch, laid out as Arrow arrays:
+   *
+   *   int    : int64_t values            (Arrow "l")
+   *   double : double values             (Arrow "g")
+   *   bool   : bit-packed values         (Arrow "b")
+   *   text   : int64_t offsets + data    (Arrow "U", large utf8)
+   *   blob   : int64_t offsets + data    (Arrow "Z", large binary)
+   *
+   * Every column has a validity bitmap, with a cleared bit for each null. Bits are least significant first.
+   */
+  class ColumnBatch
+  {
+    public:
+      // The buffers of one column
+      struct Column
+      {
+        std::string name;
+        Parameter::Type type;
+
+        // Number of nulls
+        int64_t nullCount;
+
+        // One bit per row. Set if the value is not null
+        std::vector< uint8_t > validity;
+
+        // Int values
+        std::vector< int64_t > ints;
+
+        // Double values
+        std::vector< double > doubles;
+
+        // Bool values, one bit per row
+        std::vector< uint8_t > bits;
+
+        // Text and blob values. Row n is data[ offsets[n] ] to data[ offsets[n+1] ]
+        std::vector< int64_t > offsets;
+        std::vector< char > data;
+      };
+
+      // The container of columns
+      typedef std::vector< Column > ColumnVector;
+
+    private:
+      // The columns, in the order of the query
+      ColumnVector _columns;
+
+      // Number of rows in the batch
+      size_t _rows;
+
+
+    public:
+      // Create empty buffers for the columns of a query
+      explicit ColumnBatch( const Query& );
+
+
+      // Empty every column, keeping the memory for the next batch
+      void clear();
+
+      // Reserve space for the number of rows
+      void reserve( size_t );
+
+      // Append the current row of a statement
+      void append( sqlite3_stmt* );
+
+
+      // Number of rows
+      size_t rows() const { return _rows; }
+
+      // Number of columns
+      size_t countColumns() const { return _columns.size(); }
+
+      // Return a column
+      const Column& getColumn( size_t n ) const { return _columns[ n ]; }
+
+      // Returns true if the value in a row of a column is not null
+      bool valid( size_t column, size_t row ) const { return _columns[ column ].validity[ row / 8 ] & ( 1 << ( row % 8 ) ); }
+
+
+      // Move the batch into an Arrow struct array with a child per column, and describe it in the schema.
+      // The consumer owns both and must call their release callbacks. The batch is left empty.
+      void exportArrow( ArrowArray*, ArrowSchema* );
+  };
+
+}
+
+#endif // SQLW_COLUMN_BATCH_H_
+
@@ -2,17 +2,37 @@
 #ifndef SQLW_DATABASE_H_
 #define SQLW_DATABASE_H_
 
+#include "BusyPolicy.h"
+#include "PerformanceProfile.h"
+#include "Metrics.h"
+#include "BlobStream.h"
+
 #include "sqlite3.h"
 #include "CON.h"
 
-#include <unordered_map>
+#include <string>
+#include <vector>
 #include <mutex>
+#include <atomic>
+#include <future>
+#include <functional>
 
 
 namespace SQLW
 {
-  // Forward declare the Query class
+  // Forward declare the Query classes
   class Query;
+  class QueryPool;
+  class Parameter;
+  class WriteQueue;
+  class ThreadPool;
+  class CacheIndex;
+  class BindingPlan;
+  class KeysetPlan;
+  class ResponseEncoder;
+  class ResponseArena;
+  class QueryRegistry;
+  struct Status;
 
 
   // Struct to hold the database pointer and its associated mutex
@@ -20,6 +40,52 @@ namespace SQLW
   {
     sqlite3* database;
     std::mutex mutex;
+
+    // Caches to invalidate when this connection writes. Only set on the writer, if any query is cached
+    CacheIndex* caches;
+
+    // How to retry when the database is busy, unless a query has its own policy
+    BusyPolicy* busy;
+  };
+
+
+  // Runs a transaction control statement (BEGIN, COMMIT, ROLLBACK) on a connection the caller has locked.
+  // Retries while the database is busy, following the connection's policy. Returns false if it fails.
+  // Invalidates any cached results affected by the transaction once it has ended.
+  bool transaction( Connection&, const char* );
+
+
+  /*
+   * A query looked up by name once, so that it can be run repeatedly without hashing the name each time.
+   * Default constructed handles, and those for names that don't exist, are invalid.
+   * A handle resolved before the queries are reloaded finds its query again by name the next time it is used.
+   */
+  class QueryHandle
+  {
+    friend class Database;
+
+    private:
+      // The resolved query, or null
+      QueryPool* _pool;
+
+      // Version of the registry the query was found in
+      uint64_t _version;
+
+      // Name of the query, to find it again after a reload
+      std::string _name;
+
+      // Wrap a resolved query
+      QueryHandle( QueryPool* pool, uint64_t version, const char* name ) : _pool( pool ), _version( version ), _name( name ) {}
+
+    public:
+      // Create an invalid handle
+      QueryHandle() : _pool( nullptr ), _version( 0 ), _name() {}
+
+      // Returns true if the handle refers to a query
+      bool valid() const { return _pool != nullptr; }
+
+      // Return the name of the query
+      const std::string& name() const { return _name; }
   };
 
 
@@ -31,53 +97,223 @@ namespace SQLW
     // Allow the query class to access some private functions
     friend class Query;
 
-#if defined RAPIDJSON_VERSION_STRING
-    // Json wrapper interface.
-    friend rapidjson::Document executeJson( Database&, const char*, const rapidjson::Document& );
-#endif
-
-    // Container to store the queries
-    typedef std::unordered_map< std::string, Query* > QueryMap;
-
     private:
       // Name of the file
       std::string _filename;
 
-      // Number of times to retry a busy connection
-      unsigned int _busyRetries;
+      // True if the file is never written while open. Every connection is read-only and takes no file locks
+      bool _immutable;
+
+      // How to retry a busy database. Shared by every connection and any query without its own policy
+      BusyPolicy _busyPolicy;
 
-      // Database handle
+      // Tuning applied to each connection as it is opened
+      PerformanceProfile _performance;
+
+      // Database handle. All writes are serialised through this connection
       Connection _connection;
 
-      // Hash-map of the queries implmented for this database
-      QueryMap _queries;
+      // Read-only connections. Read queries are distributed between these
+      std::vector< Connection* > _readers;
+
+      // Index of the next reader to be given a query
+      size_t _nextReader;
+
+      // The queries, their write queue and caches. Replaced as a whole by reload, and read without a lock
+      std::atomic< QueryRegistry* > _registry;
+
+      // Counts the grace periods waited for by reloads. Each pin is counted against the parity of the epoch it began in
+      std::atomic< uint64_t > _epoch;
+
+      // Number of pins held, by the parity of their epoch
+      mutable std::atomic< uint64_t > _pins[2];
+
+      // Serialises reloads
+      std::mutex _reloadMutex;
+
+      // Version of the next registry to be loaded
+      uint64_t _nextVersion;
+
+      // Runs asynchronous requests. Null unless enabled in the configuration
+      ThreadPool* _workers;
+
+
+      // Deletes the queries and closes all the connections
+      void close();
+
+      // Create and prepare every query in the configuration, on the connections already open
+      QueryRegistry* loadQueries( const CON::Object& );
+
+      // Make a registry the current one and install its caches on the writer. Returns the one it replaces
+      QueryRegistry* publish( QueryRegistry* );
+
+      // Wait until every pin taken before the call has been released
+      void synchronize();
+
+      // Opens a connection to the database file with the given flags, and applies the performance profile.
+      // Immutable databases are always opened read-only, through a URI that disables locking.
+      void openConnection( Connection&, int );
+
+      // Returns true if the statement does not write to the database
+      bool isReadOnly( const std::string& );
+
+      // Returns true if the query belongs on the readers. Trusts its read_only setting, otherwise prepares it to check
+      bool routesToReaders( const CON::Object& );
+
+      // Gives a read-only query a result cache of the given size and registers the tables it reads in the registry
+      void enableCache( QueryRegistry&, QueryPool&, size_t );
+
+      // Prepare the lazily created queries with a thread for each connection. Rethrows the first failure
+      static void prepareParallel( const std::vector< std::vector< Query* > >& );
+
+      // Compile every statement in the query configuration without keeping it. Returns a message for each problem
+      static std::vector< std::string > validateQueries( sqlite3*, const CON::Object& );
 
 
     public:
+      /*
+       * Keeps the current queries alive while a request uses them. Taking a pin never waits: it is counted
+       * and the registry is read without a lock. A reload waits for the pins taken before it to be released
+       * before deleting the queries it replaced, so hold one only for the length of a request.
+       * A thread holding a pin must not reload the database.
+       */
+      class Pin
+      {
+        private:
+          // The database whose queries are pinned
+          const Database& _database;
+
+          // Which of the database's counters this pin is counted in
+          size_t _slot;
+
+          // The pinned registry
+          const QueryRegistry* _registry;
+
+        public:
+          // Pin the database's current queries
+          explicit Pin( const Database& );
+
+          // Release them
+          ~Pin();
+
+          // Not copyable or movable
+          Pin( const Pin& ) = delete;
+          Pin& operator=( const Pin& ) = delete;
+
+          // Return the pinned registry
+          const QueryRegistry& registry() const { return *_registry; }
+
+          // Return the named query, or null if it doesn't exist
+          QueryPool* find( const char* ) const;
+
+          // Return the query of a handle, finding it again by name if it was resolved before a reload
+          QueryPool* find( const QueryHandle& ) const;
+      };
+
+
       // Open the database connection using the provided configuration
       Database( const CON::Object& );
 
+      // Open another file with the same configuration, ignoring its "database_file"
+      Database( const CON::Object&, const std::string& );
+
       // Not copy constructable/assignable
       Database( const Database& ) = delete;
       Database& operator=( const Database& ) = delete;
 
-      // Use the default move constructor/assignment
-      Database( Database&& ) = default;
-      Database& operator=( Database&& ) = default;
+      // Not movable, as requests refer to it while they run
+      Database( Database&& ) = delete;
+      Database& operator=( Database&& ) = delete;
 
       // Clean up
       ~Database();
 
 
+      // Check that every query in the configuration compiles against the database file, with the configured
+      // number of parameters and no more columns than the statement returns. Nothing is kept open.
+      // Returns a message for each problem, so an empty list means the configuration is valid.
+      static std::vector< std::string > validate( const CON::Object& );
+
+
+
+      // Load the queries of a new configuration and swap them in without stopping requests. Only "query_data",
+      // "write_queue", "prepare", "validate" and "metrics" are read; the connections are kept.
+      // Requests already running finish on the old queries, which are deleted once they have all been released.
+      // Throws, keeping the current queries, if the new configuration fails to load.
+      void reload( const CON::Object& );
+
 
       // Return a reference to a stored query for access to the manual interface
-      // References are valid for the lifetime of the database object.
+      // References are valid until the queries are reloaded.
       Query& requestQuery( const char* );
 
+      // Return the pool of prepared copies of a query, so that threads can check out a free copy.
+      // References are valid until the queries are reloaded.
+      QueryPool& requestPool( const char* );
+
 
       // Return true if the query exists. For runtime assertion that the configuration was loaded correctly
       bool queryExists( const char* ) const;
 
+      // Look up a query once, for the json functions to run without finding it by name.
+      // Returns an invalid handle if the query doesn't exist.
+      QueryHandle resolve( const char* ) const;
+
+
+      // Return the default retry policy, with the contention seen by queries that use it
+      const BusyPolicy& busyPolicy() const { return _busyPolicy; }
+
+
+      // Read back the settings the writer connection is using (journal mode, synchronous, cache size, etc.)
+      PerformanceProfile::Settings performance();
+
+
+      // Return the number of read-only connections
+      size_t countReaders() const { return _readers.size(); }
+
+      // Return true if the database was opened as immutable
+      bool immutable() const { return _immutable; }
+
+
+      // Open a blob for incremental reading, or writing, by table, column and rowid. Throws if it can't be opened.
+      // Read-only blobs use a free reader connection if there is one. Writable blobs use the writer.
+      // The connection stays locked until the stream is closed.
+      BlobStream openBlob( const char*, const char*, int64_t, bool = false );
+
+
+      // Queue a write to be committed alongside writes from other threads. Requires the write queue to be enabled.
+      // The loader sets the query parameters on the writer thread, so it must own everything it refers to.
+      // The future completes once the write has been committed.
+      std::future< Status > enqueue( const char*, std::function< bool( Query& ) > );
+
+      // Queue a write on the write queue of the pinned queries. The queue commits everything before those queries
+      // are deleted, so the loader may refer to them.
+      std::future< Status > enqueue( const Pin&, const char*, std::function< bool( Query& ) > );
+
+      // Return true if queued writes are enabled
+      bool hasWriteQueue() const;
+
+
+      // Run a task on a worker thread with a free copy of the query checked out and locked.
+      // The task drives the manual interface (prepare/step/reset). Requires worker threads to be enabled.
+      // The future completes when the task returns, and carries any exception it throws.
+      std::future< void > executeAsync( const char*, std::function< void( Query& ) > );
+
+      // Queue a job on the worker threads. Requires worker threads to be enabled
+      void submit( std::function< void() > );
+
+      // Return true if asynchronous execution is enabled
+      bool hasWorkers() const { return _workers != nullptr; }
+
+
+      // Snapshot the metrics of every query, sorted by name. Empty unless "metrics" is enabled
+      std::vector< QueryStatistics > statistics() const;
+
+
+      // Drop every cached result. Needed if another process or connection has written to the database,
+      // as only writes made through this object are detected.
+      void invalidateCaches();
+
   };
 
 
@@ -89,6 +325,67 @@ namespace SQLW
   // Run the query name parsing JSON data in and out
   rapidjson::Document executeJson( Database&, const char*, const rapidjson::Document& );
 
+  // Run a resolved query parsing JSON data in and out
+  rapidjson::Document executeJson( Database&, const QueryHandle&, const rapidjson::Document& );
+
+  // Run the query name, building the response in a reusable arena rather than a new document.
+  // The response belongs to the arena and is valid until the arena is next reset.
+  rapidjson::Document& executeJson( Database&, const char*, const rapidjson::Document&, ResponseArena& );
+
+  // Run a resolved query, building the response in a reusable arena
+  rapidjson::Document& executeJson( Database&, const QueryHandle&, const rapidjson::Document&, ResponseArena& );
+
+  // Run the query name with the request parsed straight from a buffer of JSON, binding each value as it is read.
+  // No document is built and strings aren't copied. The buffer is parsed in place, so its contents are overwritten.
+  rapidjson::Document executeJsonRaw( Database&, const char*, char*, size_t );
+
+  // Run a resolved query with the request parsed in place from a buffer of JSON
+  rapidjson::Document executeJsonRaw( Database&, const QueryHandle&, char*, size_t );
+
+  // Run the query name with JSON parameters, writing the response with an encoder (e.g. MessagePack) instead of rapidjson.
+  // Rows are encoded as they are stepped. Cached responses are not used.
+  void executeEncoded( Database&, const char*, const rapidjson::Document&, ResponseEncoder& );
+
+  // Run a resolved query with JSON parameters, writing the response with an encoder
+  void executeEncoded( Database&, const QueryHandle&, const rapidjson::Document&, ResponseEncoder& );
+
+  // Run the query name on a worker thread. The request is copied, so the caller needn't keep it.
+  std::future< rapidjson::Document > executeJsonAsync( Database&, const char*, const rapidjson::Document& );
+
+  // Run the query name on a worker thread and pass the response to the callback, on that thread.
+  // If the query throws, the callback is passed a failed response with the exception's message. The callback must not throw.
+  void executeJsonAsync( Database&, const char*, const rapidjson::Document&, std::function< void( rapidjson::Document& ) > );
+
+  // Queue the query name with the JSON parameters on the write queue. The data is copied.
+  std::future< Status > executeJsonQueued( Database&, const char*, const rapidjson::Document& );
+
+  // Run the query name once for every object in a JSON array, within a single transaction.
+  // Returns the status of each item in the "data" array.
+  rapidjson::Document executeJsonBatch( Database&, const char*, const rapidjson::Document& );
+
+  // Run a resolved query once for every object in a JSON array, within a single transaction.
+  rapidjson::Document executeJsonBatch( Database&, const QueryHandle&, const rapidjson::Document& );
+
+  // Dump Database::statistics() as a "data" array with an object per query. Latencies are in nanoseconds
+  rapidjson::Document statisticsJson( Database& );
+
+  // Load a parameter from the member of the same name. Returns false if it is missing or the wrong type
+  bool setParameter( Parameter&, const rapidjson::Value& );
+
+  // Load every parameter of a query from an object, walking its members once and finding each parameter
+  // through the plan. Text and blobs are bound as views of the object, so it must outlive the execution.
+  // Returns the first parameter that is missing or the wrong type, or null if they were all set.
+  const Parameter* bindJson( const BindingPlan&, Query&, const rapidjson::Value& );
+
+  // Load the parameters of a request with bindJson. A paged query may be sent a "cursor" token in place of its keys.
+  // Returns the name of the first parameter that is missing or the wrong type, "cursor" if the token is invalid,
+  // or null if they were all set.
+  const char* bindRequest( const QueryPool&, Query&, const rapidjson::Value& );
+
+  // Read the keys of the last of an array of rows, as returned by executeJson, back into the query's key columns.
+  // Used for pages answered from the cache, which aren't stepped. Returns false if there is no next page.
+  bool loadPageKeys( const KeysetPlan&, Query&, const rapidjson::Value& );
+
 #endif
 
 }
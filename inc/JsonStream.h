@@ -0,0 +1,196 @@
+
+#ifndef SQLW_JSON_STREAM_H_
+#define SQLW_JSON_STREAM_H_
+
+#include "Database.h"
+#include "Query.h"
+#include "QueryPool.h"
+
+#include "rapidjson/document.h"
+
+
+namespace SQLW
+{
+
+  // Write a column of the current row to a rapidjson writer, straight from sqlite's row buffer
+  template < class WRITER >
+  void writeColumn( const Query& query, size_t n, WRITER& writer )
+  {
+    switch( query.getColumn( n ).type() )
+    {
+      case Parameter::Text :
+      case Parameter::Blob :
+        {
+          std::string_view view = query.columnView( n );
+          writer.String( view.data(), static_cast< rapidjson::SizeType >( view.size() ) );
+        }
+        break;
+
+      case Parameter::Int :
+        writer.Int64( query.columnInt( n ) );
+        break;
+
+      case Parameter::Bool :
+        writer.Bool( query.columnInt( n ) != 0 );
+        break;
+
+      case Parameter::Double :
+        writer.Double( query.columnDouble( n ) );
+        break;
+    }
+  }
+
+
+  // Stream the response of a query the caller has pinned. Null if it doesn't exist
+  template < class WRITER >
+  void streamJson( QueryPool* found, const rapidjson::Document& data, WRITER& writer )
+  {
+    writer.StartObject();
+
+    if ( found == nullptr )
+    {
+      writer.Key( "success" );
+      writer.Bool( false );
+      writer.Key( "error" );
+      writer.String( "Invalid request. Does not exist." );
+      writer.Key( "data" );
+      writer.StartArray();
+      writer.EndArray();
+      writer.EndObject();
+      return;
+    }
+
+    QueryPool& pool = *found;
+
+    // Check out a free copy of the query. We're using it now
+    Query::LockType query_lock = pool.checkout();
+    Query& query = *query_lock.mutex();
+
+    const KeysetPlan& keyset = pool.keyset();
+
+    // Load the parameters. The request outlives the execution, so strings are bound in place
+    const char* invalid = bindRequest( pool, query, data );
+    if ( invalid != nullptr )
+    {
+      std::string err_string( "Invalid request parameter: " );
+      err_string += invalid;
+
+      writer.Key( "success" );
+      writer.Bool( false );
+      writer.Key( "error" );
+      writer.String( err_string.c_str(), err_string.size() );
+      writer.Key( "data" );
+      writer.StartArray();
+      writer.EndArray();
+      writer.EndObject();
+      return;
+    }
+
+    writer.Key( "data" );
+
+    // Cached responses are written as they are. Rows that are stepped aren't cached, as nothing is kept
+    ResultCache* cache = pool.cache();
+    if ( cache != nullptr )
+    {
+      uint64_t generation;
+      ResultCache::Entry entry = cache->find( ResultCache::makeKey( query ), generation );
+      if ( entry )
+      {
+        entry->Accept( writer );
+        writer.Key( "success" );
+        writer.Bool( true );
+
+        // Cached pages aren't stepped, so the keys are read back from the last row
+        if ( keyset.enabled() && loadPageKeys( keyset, query, *entry ) )
+        {
+          std::string token = keyset.encode( query );
+          writer.Key( "next" );
+          writer.String( token.c_str(), token.size() );
+        }
+
+        writer.EndObject();
+        return;
+      }
+    }
+
+    writer.StartArray();
+
+    size_t rows = 0;
+
+    // True if the last row has a null key
+    bool null_key = false;
+
+    // Lock the database connection
+    query.prepare();
+
+    // Step through the query. The row is written directly, without copying it into the columns. Only the keys are copied
+    while ( query.stepView() )
+    {
+      writer.StartObject();
+      for ( size_t i = 0; i < query.countColumns(); ++i )
+      {
+        const std::string& key = query.getColumnKey( i );
+        writer.RawValue( key.c_str(), key.size(), rapidjson::kStringType );
+        writeColumn( query, i, writer );
+      }
+      writer.EndObject();
+      rows += 1;
+
+      if ( keyset.enabled() )
+        null_key = ! keyset.record( query );
+    }
+
+    // Release the database connection
+    query.reset();
+
+    writer.EndArray();
+
+    const bool next_page = keyset.enabled() && keyset.more( query, rows );
+
+    if ( query.error() || ( next_page && null_key ) )
+    {
+      writer.Key( "success" );
+      writer.Bool( false );
+      writer.Key( "error" );
+      writer.String( query.error() ? query.getError() : KeysetPlan::nullKeyError );
+    }
+    else
+    {
+      writer.Key( "success" );
+      writer.Bool( true );
+
+      if ( next_page )
+      {
+        std::string token = keyset.encode( query );
+        writer.Key( "next" );
+        writer.String( token.c_str(), token.size() );
+      }
+    }
+
+    writer.EndObject();
+  }
+
+
+  // Run a resolved query and write the response straight to a rapidjson writer as each row is stepped.
+  // Produces the same object as executeJson, except that "data" is written before "success", "error" and "next"
+  // as the outcome is only known once every row has been read. Nothing is buffered or copied between rows.
+  template < class WRITER >
+  void executeJsonStream( Database& db, const QueryHandle& handle, const rapidjson::Document& data, WRITER& writer )
+  {
+    Database::Pin pin( db );
+    streamJson( pin.find( handle ), data, writer );
+  }
+
+
+  // Run the named query, streaming the response to a rapidjson writer
+  template < class WRITER >
+  void executeJsonStream( Database& db, const char* name, const rapidjson::Document& data, WRITER& writer )
+  {
+    Database::Pin pin( db );
+    streamJson( pin.find( name ), data, writer );
+  }
+
+}
+
+#endif // SQLW_JSON_STREAM_H_
+
@@ -0,0 +1,93 @@
+
+#ifndef SQLW_KEYSET_PLAN_H_
+#define SQLW_KEYSET_PLAN_H_
+
+#include "CON.h"
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+
+namespace SQLW
+{
+  class Query;
+
+
+  /*
+   * Keyset pagination for a query, built once when the query is loaded from its "keyset" configuration:
+   *
+   *   keyset : { keys : [ { column : "index", parameter : "after" } ], limit : "count" }
+   *
+   * The statement does the seeking itself, e.g. "WHERE DeviceIndex > ?1 ORDER BY DeviceIndex LIMIT ?2", so
+   * every page starts from an index lookup rather than skipping the rows before it.
+   * The values of the key columns in the last row of a page are packed into an opaque token. Decoding the token
+   * into the key parameters resumes the query after that row. With a limit parameter, a page shorter than the
+   * limit is known to be the last. A full page whose last row has a null key is an error, as it can't be resumed.
+   */
+  class KeysetPlan
+  {
+    public:
+      // Returned when there is no limit parameter
+      static const size_t npos = static_cast< size_t >( -1 );
+
+      // The error for a page that ends on a row with a null key, as there is nothing to resume after
+      static const char* const nullKeyError;
+
+    private:
+      // Column and parameter index of each key, in order
+      std::vector< size_t > _columns;
+      std::vector< size_t > _parameters;
+
+      // Index of the parameter holding the page size, or npos
+      size_t _limit;
+
+      // Hash of the query name, so tokens from other queries are refused
+      uint32_t _check;
+
+
+    public:
+      // Create an empty plan. Queries without one aren't paged
+      KeysetPlan();
+
+
+      // Build the plan from the configuration of the keys and the query they refer to.
+      // Throws if a key names a column or parameter the query doesn't have, or their types differ.
+      void build( const Query&, const std::string&, const CON::Object& );
+
+
+      // Returns true if the query is paged
+      bool enabled() const { return ! _columns.empty(); }
+
+      // Number of key columns
+      size_t size() const { return _columns.size(); }
+
+      // Return the column index of the nth key
+      size_t column( size_t n ) const { return _columns[ n ]; }
+
+      // Return the parameter index of the nth key
+      size_t parameter( size_t n ) const { return _parameters[ n ]; }
+
+      // Return the index of the limit parameter, or npos
+      size_t limit() const { return _limit; }
+
+
+      // Copy the key columns of the current row into the query's columns, ready to encode. Call after each step,
+      // as the row is gone once stepping stops. Returns false if a key is null
+      bool record( Query& ) const;
+
+      // Returns true if a page of the given number of rows may be followed by another, judged by the limit parameter
+      bool more( const Query&, size_t ) const;
+
+      // Pack the key columns of the query into a token. The columns must hold the last row of the page
+      std::string encode( const Query& ) const;
+
+      // Set the key parameters of the query from a token. Returns false, changing nothing, if it isn't a valid token
+      bool decode( std::string_view, Query& ) const;
+  };
+
+}
+
+#endif // SQLW_KEYSET_PLAN_H_
+
@@ -0,0 +1,178 @@
+
+#ifndef SQLW_METRICS_H_
+#define SQLW_METRICS_H_
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <chrono>
+
+
+namespace SQLW
+{
+
+  /*
+   * Lock-free latency histogram in the style of HdrHistogram.
+   * Buckets double in width every 8 buckets, so any value is recorded to within 12.5%.
+   */
+  class Histogram
+  {
+    public:
+      // Number of buckets needed to cover every 64 bit value
+      static const size_t BucketCount = 496;
+
+    private:
+      // Number of values recorded into each bucket
+      std::atomic< uint64_t > _buckets[ BucketCount ];
+
+      // Number of values recorded
+      std::atomic< uint64_t > _count;
+
+      // Sum of the values recorded
+      std::atomic< uint64_t > _sum;
+
+      // Largest value recorded
+      std::atomic< uint64_t > _max;
+
+
+      // Bucket a value is recorded in
+      static size_t bucket( uint64_t );
+
+      // Largest value recorded in a bucket
+      static uint64_t upperBound( size_t );
+
+
+    public:
+      // Empty histogram
+      Histogram();
+
+      // Not copyable or movable
+      Histogram( const Histogram& ) = delete;
+      Histogram( Histogram&& ) = delete;
+      Histogram& operator=( const Histogram& ) = delete;
+      Histogram& operator=( Histogram&& ) = delete;
+
+
+      // Record a value. Safe to call from any thread
+      void record( uint64_t );
+
+      // Number of values recorded
+      uint64_t count() const { return _count.load( std::memory_order_relaxed ); }
+
+      // Mean of the values recorded
+      uint64_t mean() const;
+
+      // Largest value recorded
+      uint64_t max() const { return _max.load( std::memory_order_relaxed ); }
+
+      // Value below which the fraction (0 to 1) of recorded values fall, rounded up to its bucket
+      uint64_t percentile( double ) const;
+  };
+
+
+  // Snapshot of a histogram, in nanoseconds
+  struct LatencySummary
+  {
+    uint64_t count;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+  };
+
+
+  // Snapshot of the metrics of a named query
+  struct QueryStatistics
+  {
+    std::string name;
+
+    // Number of executions and how many failed
+    uint64_t executions;
+    uint64_t errors;
+
+    // Rows returned, and bytes of data read from them
+    uint64_t rows;
+    uint64_t bytes;
+
+    // Number of times a step found the database busy
+    uint64_t busyRetries;
+
+    // Waiting for a free copy of the query
+    LatencySummary queryWait;
+
+    // Waiting for the connection to be free
+    LatencySummary connectionWait;
+
+    // Binding the parameters
+    LatencySummary bind;
+
+    // Stepping the statement, summed over every row of an execution
+    LatencySummary step;
+  };
+
+
+  /*
+   * Counters for one named query, shared by all of its copies.
+   */
+  class QueryMetrics
+  {
+    public:
+      // The clock used for all measurements
+      typedef std::chrono::steady_clock Clock;
+
+    private:
+      // Counters
+      std::atomic< uint64_t > _executions;
+      std::atomic< uint64_t > _errors;
+      std::atomic< uint64_t > _rows;
+      std::atomic< uint64_t > _bytes;
+      std::atomic< uint64_t > _busyRetries;
+
+      // Latencies in nanoseconds
+      Histogram _queryWait;
+      Histogram _connectionWait;
+      Histogram _bind;
+      Histogram _step;
+
+
+      // Summarise a histogram
+      static LatencySummary summarise( const Histogram& );
+
+
+    public:
+      // Everything starts at zero
+      QueryMetrics();
+
+
+      // Nanoseconds since the start time
+      static uint64_t since( Clock::time_point start )
+      {
+        return std::chrono::duration_cast< std::chrono::nanoseconds >( Clock::now() - start ).count();
+      }
+
+
+      // Record the outcome of an execution
+      void execution( bool error, uint64_t rows, uint64_t bytes, uint64_t step );
+
+      // Record a wait for the query
+      void queryWait( uint64_t time ) { _queryWait.record( time ); }
+
+      // Record a wait for the connection
+      void connectionWait( uint64_t time ) { _connectionWait.record( time ); }
+
+      // Record the time taken to bind the parameters
+      void bind( uint64_t time ) { _bind.record( time ); }
+
+      // Record busy retries
+      void busy( uint64_t retries ) { _busyRetries.fetch_add( retries, std::memory_order_relaxed ); }
+
+
+      // Take a snapshot. The counters are read individually, so may be slightly inconsistent with each other
+      QueryStatistics snapshot( const std::string& ) const;
+  };
+
+}
+
+#endif // SQLW_METRICS_H_
+
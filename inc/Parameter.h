@@ -5,6 +5,7 @@
 #include "sqlite3.h"
 
 #include <string>
+#include <string_view>
 
 
 namespace SQLW
@@ -35,6 +36,18 @@ namespace SQLW
       // Enumerated type identifier
       Type _type;
 
+      // Caller owned text or blob data, bound in place of the stored value
+      std::string_view _view;
+
+      // True while the view should be bound instead of the stored value
+      bool _useView;
+
+      // Length of a zero-filled blob to bind, reserving space to be written later
+      size_t _zeroLength;
+
+      // True while a zero-filled blob should be bound instead of the stored value
+      bool _useZero;
+
 
       // sets the parameter to an sqlite statement
       void assignStatement( sqlite3_stmt*, size_t );
@@ -83,9 +96,31 @@ namespace SQLW
       void set( std::string );
       void set( int64_t );
       void set( bool );
-      void set( void* );
       void set( double );
 
+      // Sets a blob from a null terminated buffer. Use the sized version for binary data
+      void set( void* );
+
+      // Sets a blob from a buffer of the given length. Will assert type is correct!
+      void set( const void*, size_t );
+
+      // Copies text or blob data into the stored value, reusing its memory. Will assert type is correct!
+      void assign( std::string_view );
+
+      // Binds caller owned text or blob data without copying it. Will assert type is correct!
+      // The data must stay valid until the query has been reset, which releases it. The next call to set() replaces it.
+      void bindView( std::string_view );
+
+      // Forget data bound with bindView, leaving the value empty. Returns false if there was none
+      bool releaseView();
+
+      // Binds a blob of zeros of the given length, without allocating it. Will assert type is correct!
+      // Once the row is written, the blob can be filled in chunks with a BlobStream.
+      void bindZeroBlob( size_t );
+
+      // Return the text or blob value that will be bound, whether stored or viewed. Will assert type is correct!
+      std::string_view view() const;
+
   };
 
 }
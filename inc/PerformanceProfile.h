@@ -0,0 +1,87 @@
+
+#ifndef SQLW_PERFORMANCE_PROFILE_H_
+#define SQLW_PERFORMANCE_PROFILE_H_
+
+#include "sqlite3.h"
+#include "CON.h"
+
+#include <vector>
+#include <string>
+#include <utility>
+
+
+namespace SQLW
+{
+
+  /*
+   * Tuning applied to every connection as it is opened, from the "performance" block of the configuration.
+   * A named preset can be given first and then adjusted by the individual settings:
+   *
+   *   read_heavy : WAL, synchronous=normal, 64MiB cache, 256MiB memory map, in-memory temporaries
+   *   bulk_load  : WAL, synchronous=off, 256MiB cache, in-memory temporaries. Commits aren't durable!
+   *   durable    : WAL, synchronous=full, no memory map
+   *
+   * Anything not set is left at sqlite's default.
+   */
+  class PerformanceProfile
+  {
+    public:
+      // Pragma names and values, in the order they are applied or read
+      typedef std::vector< std::pair< std::string, std::string > > Settings;
+
+    private:
+      // The pragmas to apply
+      Settings _pragmas;
+
+      // Lookaside slot size and count. Zero to leave sqlite's default
+      int _lookasideSize;
+      int _lookasideCount;
+
+
+      // Set a pragma, keeping the order page_size must be applied in (before the journal mode)
+      void set( const std::string&, const std::string& );
+
+      // Load the settings of a named preset. Throws if the name is unknown
+      void preset( const std::string& );
+
+      // Run a pragma and return the first value it reports
+      static std::string pragma( sqlite3*, const std::string& );
+
+
+    public:
+      // Nothing set
+      PerformanceProfile();
+
+
+      // Load and validate a "performance" configuration object. Throws if a value is invalid
+      void configure( const CON::Object& );
+
+      // Apply to a newly opened connection. The journal mode and page size are only set by the writer,
+      // as they belong to the database file. Throws if a setting is refused.
+      void apply( sqlite3*, bool writer ) const;
+
+
+      // Return the requested value of a pragma, or an empty string if it isn't set
+      std::string get( const std::string& ) const;
+
+      // Return the requested journal mode, or an empty string if it isn't set
+      std::string journalMode() const { return this->get( "journal_mode" ); }
+
+      // Request a journal mode
+      void setJournalMode( const std::string& mode ) { this->set( "journal_mode", mode ); }
+
+      // Request a memory map of the given number of bytes
+      void setMmapSize( int64_t bytes ) { this->set( "mmap_size", std::to_string( bytes ) ); }
+
+
+      // The settings that were configured
+      const Settings& requested() const { return _pragmas; }
+
+      // Read back the settings a connection is actually using
+      static Settings effective( sqlite3* );
+  };
+
+}
+
+#endif // SQLW_PERFORMANCE_PROFILE_H_
+
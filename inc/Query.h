@@ -3,6 +3,8 @@
 #define SQLW_QUERY_BASE_H_
 
 #include "Parameter.h"
+#include "BusyPolicy.h"
+#include "Metrics.h"
 
 #include "sqlite3.h"
 #include "CON.h"
@@ -10,20 +12,43 @@
 
 #include <vector>
 #include <mutex>
+#include <string_view>
+#include <functional>
 
 
 namespace SQLW
 {
   struct Connection;
+  class ColumnBatch;
+
+
+  // Outcome of a single execution within a batch
+  struct Status
+  {
+    bool success;
+    std::string error;
+  };
+
+
+  template < class, class > class TypedQuery;
+
 
   class Query
   {
+    // The write queue runs queries inside its own transactions
+    friend class WriteQueue;
+
+    // Typed queries bind and read the statement directly
+    template < class, class > friend class TypedQuery;
+
+    // Bulk loads bind parsed rows straight into the statement, on the query's connection
+    friend class BulkLoader;
 
     // The parameter list type
     typedef std::vector< Parameter > ParameterVector;
 
     public:
-      // Implement the "BasicLockable" interface
+      // Implement the "Lockable" interface
       // Typedef a lock to interface with the mutex
       typedef std::unique_lock< Query > LockType;
 
@@ -31,6 +56,12 @@ namespace SQLW
       typedef ParameterVector::iterator ParameterIterator;
       typedef ParameterVector::iterator ColumnIterator;
 
+      // Loads the parameters for the nth item of a batch. Returns false if they are invalid
+      typedef std::function< bool( Query&, size_t ) > BatchLoader;
+
+      // Loads the parameters for a single execution. Returns false if they are invalid
+      typedef std::function< bool( Query& ) > Loader;
+
 
     private:
       // Store a pointer to the database so we can check for errors
@@ -42,9 +73,12 @@ namespace SQLW
       // Serialize access to this query
       std::mutex _theMutex;
 
-      // The statement pointer
+      // The statement pointer. Null until it has been prepared
       sqlite3_stmt* _theStatement;
 
+      // Prepares the statement exactly once, even if several threads ask for it
+      std::once_flag _prepared;
+
       // The name of the query
       const std::string _name;
 
@@ -54,19 +88,83 @@ namespace SQLW
       // The raw text that makes up the statement
       const std::string _statementText;
 
+      // True if the configuration declares the statement read-only. Checked when it is prepared
+      const bool _declaredReadOnly;
+
       // If an error occurs. This is not-null
       const char* _error;
 
+      // How to retry when the database is busy. Either the connection's or the query's own
+      BusyPolicy* _busyPolicy;
+
+      // True if the query configured its own policy and owns it
+      bool _ownsBusyPolicy;
+
+      // True once the statement has returned a row, until it is reset
+      bool _started;
+
+      // True once the statement has run to completion, until it is reset. Stepping again would restart it
+      bool _finished;
+
+      // Shared with the other copies of the query. Null unless metrics are enabled
+      QueryMetrics* _metrics;
+
+      // Rows, bytes and step time of the current execution, for the metrics
+      uint64_t _rowCount;
+      uint64_t _byteCount;
+      uint64_t _stepTime;
+
       // The required parameters
       ParameterVector _parameters;
 
       // The returned columns
       ParameterVector _columns;
 
+      // Column names as quoted, escaped json strings. Built once so streamed rows don't re-escape them
+      std::vector< std::string > _columnKeys;
+
+      // Tables the statement reads from, as reported by sqlite while it was prepared
+      std::vector< std::string > _readTables;
+
+      // Tables the statement writes to, including those written by triggers
+      std::vector< std::string > _writeTables;
+
+
+      // Authorizer callback used while preparing, to record the tables that are accessed
+      static int recordTables( void*, int, const char*, const char*, const char*, const char* );
+
+      // Compile the statement. The caller must hold the connection
+      void prepareStatement();
+
+      // Tell the connection's caches that this statement may have written to its tables
+      void markWritten();
+
+      // Binds the parameters to the statement
+      void bindParameters();
+
+      // Lock the connection, recording the wait
+      void lockConnection();
+
+      // Record the current execution in the metrics and clear the counts
+      void recordExecution();
+
+      // Drop parameters bound as views of the caller's data, and their bindings, so nothing refers to it once it's gone
+      void releaseViews();
+
+
+      // Steps the statement, retrying while busy. Returns true if a row is ready.
+      // Before the first row, the connection is released while waiting so other queries can use it.
+      bool stepStatement();
+
+      // Binds the parameters, runs the statement to completion and resets it, recording the outcome.
+      // Does not lock the connection. The caller must already hold it, e.g. within a transaction.
+      void execute( Status& );
+
 
     public:
-      // Database connection, name, description, statement
-      Query( Connection&, const CON::Object& );
+      // Database connection, name, description, statement.
+      // Prepares the statement immediately, unless lazy, in which case it is prepared when first used
+      Query( Connection&, const CON::Object&, bool lazy = false );
 
       // Destroy the statement
       ~Query();
@@ -78,6 +176,14 @@ namespace SQLW
       Query& operator=( Query&& ) = delete;
 
 
+      // Prepare the statement if it hasn't been yet, locking the connection while it does.
+      // Safe to call from any thread, but not while holding the connection. Throws if the statement is invalid
+      void ensurePrepared();
+
+      // Returns true once the statement has been prepared
+      bool isPrepared() const { return _theStatement != nullptr; }
+
+
       // Prepare the query. Loads the parameters into the statement and locks the database connection
       void prepare();
 
@@ -86,10 +192,28 @@ namespace SQLW
       // Error flag must be checked separately. If error is set false is guarenteed to be returned.
       bool step();
 
+      // Steps the query without copying the row into the columns. Read the row with the column*() functions below.
+      // Same return and error behaviour as step().
+      bool stepView();
+
       // Clean up the query and release the database connection. Must be called even if an error occurs!
       void reset();
 
 
+      // Steps up to n rows into the column buffers of the batch, replacing what it held.
+      // Call between prepare and reset. Returns the number of rows fetched, which is zero once every row has been read.
+      // Error flag must be checked separately.
+      size_t fetchBatch( ColumnBatch&, size_t );
+
+
+      // Runs the statement once for each of n parameter sets, within one transaction and one hold of the connection.
+      // The loader sets the parameters for each item. Any returned rows are discarded.
+      // Items that fail are rolled back individually and the rest are committed together.
+      // If the transaction can't begin or commit, the error is set and every item is reported as failed.
+      // If the loader throws, the whole batch is rolled back and the exception passed on.
+      std::vector< Status > executeBatch( size_t, const BatchLoader& );
+
+
       // Interface for checking errors during processing
       // Return's true if an error is present after the last usage
       bool error() const { return _error != nullptr; }
@@ -98,6 +222,25 @@ namespace SQLW
       const char* getError() const { return _error ? _error : ""; }
 
 
+      // Returns true if the statement does not write to the database. Must be prepared
+      bool readOnly() const { return sqlite3_stmt_readonly( _theStatement ); }
+
+      // The retry policy used when the database is busy, with the contention it has seen
+      const BusyPolicy& busyPolicy() const { return *_busyPolicy; }
+
+      // Attach the metrics shared by every copy of the query. Must be done before the query is used
+      void setMetrics( QueryMetrics* metrics ) { _metrics = metrics; }
+
+      // The metrics being recorded, or null
+      const QueryMetrics* metrics() const { return _metrics; }
+
+      // Tables read by the statement. Only known once prepared
+      const std::vector< std::string >& readTables() const { return _readTables; }
+
+      // Tables written by the statement
+      const std::vector< std::string >& writeTables() const { return _writeTables; }
+
+
       // Flags to return if the query has/expects columns/parameters
       bool hasParameters() const { return ! _parameters.empty(); }
       bool hasColumns() const { return ! _columns.empty(); }
@@ -117,6 +260,25 @@ namespace SQLW
       Parameter& getColumn( size_t n ) { return _columns[ n ]; }
       const Parameter& getColumn( size_t n ) const { return _columns[ n ]; }
 
+      // Return the name of a specific column as a quoted json string, ready to write as a raw key
+      const std::string& getColumnKey( size_t n ) const { return _columnKeys[ n ]; }
+
+
+      // Direct access to the current row, without copying it into the column parameters.
+      // Text and blob views point into sqlite's row buffer and are only valid until the next step or reset.
+
+      // Text or blob data of a column, including any embedded nulls
+      std::string_view columnView( size_t ) const;
+
+      // Integer (or bool) value of a column
+      int64_t columnInt( size_t n ) const { return sqlite3_column_int64( _theStatement, n ); }
+
+      // Floating point value of a column
+      double columnDouble( size_t n ) const { return sqlite3_column_double( _theStatement, n ); }
+
+      // Returns true if a column of the current row is null
+      bool columnNull( size_t n ) const { return sqlite3_column_type( _theStatement, n ) == SQLITE_NULL; }
+
       // Start and end of parameters
       ParameterIterator parametersBegin() { return _parameters.begin(); }
       ParameterIterator parametersEnd() { return _parameters.end(); }
@@ -132,6 +294,9 @@ namespace SQLW
       // Lock the internal mutex
       void lock();
 
+      // Lock the internal mutex only if it is free. Returns true if the lock was taken
+      bool try_lock();
+
       // Unlock the internal mutex
       void unlock();
   };
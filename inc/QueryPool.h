@@ -0,0 +1,109 @@
+
+#ifndef SQLW_QUERY_POOL_H_
+#define SQLW_QUERY_POOL_H_
+
+#include "Query.h"
+#include "ResultCache.h"
+#include "BindingPlan.h"
+#include "KeysetPlan.h"
+
+#include <vector>
+#include <atomic>
+
+
+namespace SQLW
+{
+
+  /*
+   * A set of identical queries, each prepared on a different connection.
+   * Threads check out whichever copy is free so the same named query can run concurrently.
+   */
+  class QueryPool
+  {
+    // The container of prepared copies
+    typedef std::vector< Query* > QueryVector;
+
+    private:
+      // The name of the query
+      const std::string _name;
+
+      // The copies of the query. The first is the primary
+      QueryVector _queries;
+
+      // Where the next checkout starts looking. Spreads threads across the copies
+      std::atomic< size_t > _next;
+
+      // Responses of recent executions. Null unless caching is enabled for the query
+      ResultCache* _cache;
+
+      // Metrics shared by every copy. Null unless metrics are enabled
+      QueryMetrics* _metrics;
+
+      // Parameter indices by name, built from the first copy
+      BindingPlan _plan;
+
+      // How pages of the query resume. Empty unless the query is paged
+      KeysetPlan _keyset;
+
+
+    public:
+      // Create an empty pool for the named query
+      explicit QueryPool( std::string );
+
+      // Deletes all the queries, the cache and the metrics
+      ~QueryPool();
+
+      // Not copyable or movable
+      QueryPool( const QueryPool& ) = delete;
+      QueryPool( QueryPool&& ) = delete;
+      QueryPool& operator=( const QueryPool& ) = delete;
+      QueryPool& operator=( QueryPool&& ) = delete;
+
+
+      // Take ownership of another prepared copy of the query. The first copy builds the binding plan
+      void add( Query* );
+
+      // Create a cache of the given size for the responses. Returns the cache, which the pool owns
+      ResultCache* enableCache( size_t );
+
+      // Start recording metrics for every copy. Returns the metrics, which the pool owns
+      QueryMetrics* enableMetrics();
+
+      // Page the query by the keys in the configuration, using the first copy to find them. Throws if they are invalid
+      void enableKeyset( const CON::Object& );
+
+
+      // Return the name of the query
+      const std::string& name() const { return _name; }
+
+      // Number of copies in the pool
+      size_t size() const { return _queries.size(); }
+
+      // The copy returned by Database::requestQuery
+      Query& primary() { return *_queries.front(); }
+
+      // Return a specific copy
+      Query& get( size_t n ) { return *_queries[ n ]; }
+
+      // The response cache, or null if the query isn't cached
+      ResultCache* cache() { return _cache; }
+
+      // The metrics, or null if they aren't enabled
+      const QueryMetrics* metrics() const { return _metrics; }
+
+      // Parameter indices by name, shared by every copy
+      const BindingPlan& plan() const { return _plan; }
+
+      // Key columns and parameters for keyset pagination
+      const KeysetPlan& keyset() const { return _keyset; }
+
+
+      // Returns a lock on a free copy of the query. The query is released when the lock is destroyed.
+      // Each copy is tried without blocking first. Only waits if every copy is in use.
+      Query::LockType checkout();
+  };
+
+}
+
+#endif // SQLW_QUERY_POOL_H_
+
@@ -0,0 +1,85 @@
+
+#ifndef SQLW_QUERY_REGISTRY_H_
+#define SQLW_QUERY_REGISTRY_H_
+
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+
+
+namespace SQLW
+{
+  class QueryPool;
+  class WriteQueue;
+  class CacheIndex;
+
+
+  /*
+   * One loaded configuration of queries: the pools, the write queue that runs their queued writes and the
+   * index of their caches. The database builds it in full before publishing it and never changes it
+   * afterwards, so it is read without a lock. Reloading the configuration replaces the whole registry.
+   */
+  class QueryRegistry
+  {
+    public:
+      // Container to store the queries
+      typedef std::unordered_map< std::string, QueryPool* > QueryMap;
+
+    private:
+      // The queries by name
+      QueryMap _queries;
+
+      // Coalesces queued writes into group commits. Null unless enabled in the configuration
+      WriteQueue* _writeQueue;
+
+      // Tracks the tables read by cached queries. Null unless a query is cached
+      CacheIndex* _caches;
+
+      // Distinguishes this registry from the ones before and after it
+      uint64_t _version;
+
+
+    public:
+      // Create an empty registry
+      explicit QueryRegistry( uint64_t );
+
+      // Commits anything still queued, then deletes the queries and the caches
+      ~QueryRegistry();
+
+      // Not copyable or movable
+      QueryRegistry( const QueryRegistry& ) = delete;
+      QueryRegistry( QueryRegistry&& ) = delete;
+      QueryRegistry& operator=( const QueryRegistry& ) = delete;
+      QueryRegistry& operator=( QueryRegistry&& ) = delete;
+
+
+      // Take ownership of a query. Returns false, without taking it, if the name is already used
+      bool add( QueryPool* );
+
+      // Take ownership of the write queue
+      void setWriteQueue( WriteQueue* );
+
+      // Return the cache index, creating it the first time
+      CacheIndex& watchCaches();
+
+
+      // Return the named query, or null if it doesn't exist
+      QueryPool* find( const std::string& ) const;
+
+      // Return every query
+      const QueryMap& queries() const { return _queries; }
+
+      // Return the write queue, or null
+      WriteQueue* writeQueue() const { return _writeQueue; }
+
+      // Return the cache index, or null
+      CacheIndex* caches() const { return _caches; }
+
+      // Return the version
+      uint64_t version() const { return _version; }
+  };
+
+}
+
+#endif // SQLW_QUERY_REGISTRY_H_
+
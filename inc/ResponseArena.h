@@ -0,0 +1,73 @@
+
+#ifndef SQLW_RESPONSE_ARENA_H_
+#define SQLW_RESPONSE_ARENA_H_
+
+#include "rapidjson/document.h"
+
+#include <memory>
+#include <optional>
+
+
+namespace SQLW
+{
+
+  /*
+   * Reusable memory for executeJson responses. Keep one per thread and pass it to every request.
+   *
+   * The response is built in a buffer the arena owns, and resetting it just rewinds the buffer, so a steady
+   * stream of requests allocates nothing for their responses. A response that outgrows the buffer spills into
+   * extra chunks. They are freed at the next reset, and the buffer is enlarged to fit, so it settles at the size
+   * of the largest response.
+   */
+  class ResponseArena
+  {
+    public:
+      // The allocator the responses use
+      typedef rapidjson::MemoryPoolAllocator< rapidjson::CrtAllocator > AllocatorType;
+
+    private:
+      // The memory responses are built in
+      std::unique_ptr< char[] > _buffer;
+
+      // Size of the buffer
+      size_t _capacity;
+
+      // Allocates the chunks beyond the buffer
+      rapidjson::CrtAllocator _base;
+
+      // Hands out the buffer. Rebuilt in place at each reset, which is constant time unless it spilled
+      std::optional< AllocatorType > _allocator;
+
+      // The current response
+      std::optional< rapidjson::Document > _document;
+
+
+    public:
+      // Create an arena with a buffer of the given size in bytes
+      explicit ResponseArena( size_t = 64 * 1024 );
+
+      // Not copyable or movable, as the response refers to the allocator
+      ResponseArena( const ResponseArena& ) = delete;
+      ResponseArena( ResponseArena&& ) = delete;
+      ResponseArena& operator=( const ResponseArena& ) = delete;
+      ResponseArena& operator=( ResponseArena&& ) = delete;
+
+
+      // Discard the current response and return a new, empty object. Invalidates everything built in the arena
+      rapidjson::Document& reset();
+
+      // The current response
+      rapidjson::Document& document() { return *_document; }
+
+      // Size of the buffer. Grows when a response doesn't fit
+      size_t capacity() const { return _capacity; }
+
+
+      // An arena for the calling thread, created on first use
+      static ResponseArena& local();
+  };
+
+}
+
+#endif // SQLW_RESPONSE_ARENA_H_
+
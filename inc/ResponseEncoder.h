@@ -0,0 +1,132 @@
+
+#ifndef SQLW_RESPONSE_ENCODER_H_
+#define SQLW_RESPONSE_ENCODER_H_
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+
+namespace SQLW
+{
+  class Query;
+  class KeysetPlan;
+
+
+  /*
+   * Interface to write a query response in a format other than rapidjson, straight from the query's row buffer.
+   * Produces the same success/error/data response as executeJson. The calls for one response are:
+   *
+   *   begin, row (for each row), end     or     fail
+   */
+  class ResponseEncoder
+  {
+    public:
+      virtual ~ResponseEncoder() {}
+
+      // Start a response to the query, before its first row
+      virtual void begin( const Query& ) = 0;
+
+      // Write the current row of the query
+      virtual void row( const Query& ) = 0;
+
+      // Finish the response once the query has been reset. The error is only read if it failed, in which case
+      // the rows written so far should be dropped. The last is the token for the next page, or empty if there isn't one
+      virtual void end( bool, const char*, std::string_view ) = 0;
+
+      // Write a whole response for a request that failed before the query ran
+      virtual void fail( const char* ) = 0;
+  };
+
+
+  // Run a query that has its parameters set, writing the response as each row is stepped.
+  // The caller must have checked out the query. With the query's keyset, the token for the next page is passed to end.
+  void encodeResponse( Query&, ResponseEncoder&, const KeysetPlan* = nullptr );
+
+
+  /*
+   * Encodes responses as MessagePack into a growable byte buffer, which is reused by each response.
+   *
+   *   Objects : { "success", "error", "next", "data" : [ { column : value, ... }, ... ] }    the same shape as the json
+   *   Rows    : { "success", "error", "next", "columns" : [ names ], "data" : [ [ values ], ... ] }
+   *
+   * Rows writes the column names once, which is much more compact for many rows.
+   * Blobs are written as binary, and null values as nil.
+   */
+  class MessagePackEncoder : public ResponseEncoder
+  {
+    public:
+      // How rows are laid out
+      enum Layout { Objects, Rows };
+
+    private:
+      // The encoded response
+      std::vector< uint8_t > _buffer;
+
+      // The row layout
+      Layout _layout;
+
+      // Position of the response's map header and the data array's header, to fill in their sizes at the end
+      size_t _mapHeader;
+      size_t _arrayHeader;
+
+      // Number of rows written
+      uint32_t _rows;
+
+
+      // Append raw bytes
+      void append( const void*, size_t );
+
+      // Append a big endian value of the given width
+      void appendBig( uint64_t, size_t );
+
+      // Overwrite a big endian 32-bit value
+      void patch32( size_t, uint32_t );
+
+      // Write values
+      void writeNil();
+      void writeBool( bool );
+      void writeInt( int64_t );
+      void writeDouble( double );
+      void writeString( std::string_view );
+      void writeBinary( std::string_view );
+      void writeArray( uint32_t );
+      void writeMap( uint32_t );
+
+      // Write column n of the current row
+      void writeColumn( const Query&, size_t );
+
+
+    public:
+      // Create an empty encoder
+      explicit MessagePackEncoder( Layout = Rows );
+
+
+      // Start a response to the query, after emptying the buffer
+      void begin( const Query& ) override;
+
+      // Write the current row of the query
+      void row( const Query& ) override;
+
+      // Finish the response
+      void end( bool, const char*, std::string_view ) override;
+
+      // Write a whole response for a failed request, after emptying the buffer
+      void fail( const char* ) override;
+
+
+      // The encoded response
+      const std::vector< uint8_t >& buffer() const { return _buffer; }
+
+      // Return the layout
+      Layout layout() const { return _layout; }
+
+      // Empty the buffer, keeping its memory
+      void clear() { _buffer.clear(); }
+  };
+
+}
+
+#endif // SQLW_RESPONSE_ENCODER_H_
+
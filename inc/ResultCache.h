@@ -0,0 +1,141 @@
+
+#ifndef SQLW_RESULT_CACHE_H_
+#define SQLW_RESULT_CACHE_H_
+
+#include "sqlite3.h"
+#include "rapidjson/document.h"
+
+#include <unordered_map>
+#include <vector>
+#include <list>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+
+namespace SQLW
+{
+  class Query;
+
+
+  /*
+   * Least-recently-used cache of the responses of a read-only query, keyed by the parameter values.
+   * Entries are shared and immutable, so they can be handed out without holding the cache lock.
+   */
+  class ResultCache
+  {
+    public:
+      // A cached "data" array
+      typedef std::shared_ptr< const rapidjson::Document > Entry;
+
+    private:
+      // Container types
+      typedef std::list< std::pair< std::string, Entry > > EntryList;
+      typedef std::unordered_map< std::string, EntryList::iterator > EntryMap;
+
+      // Maximum number of entries
+      const size_t _capacity;
+
+      // Protects everything below
+      std::mutex _mutex;
+
+      // Entries, most recently used first
+      EntryList _entries;
+
+      // Lookup of entries by key
+      EntryMap _index;
+
+      // Incremented on every invalidation. Results read before an invalidation are not stored.
+      uint64_t _generation;
+
+
+    public:
+      // Create an empty cache of the given size
+      explicit ResultCache( size_t );
+
+      // Not copyable or movable
+      ResultCache( const ResultCache& ) = delete;
+      ResultCache( ResultCache&& ) = delete;
+      ResultCache& operator=( const ResultCache& ) = delete;
+      ResultCache& operator=( ResultCache&& ) = delete;
+
+
+      // Build a key from the current parameter values of a query
+      static std::string makeKey( const Query& );
+
+
+      // Return the entry for the key, or null. Sets the generation to pass to a later insert
+      Entry find( const std::string&, uint64_t& );
+
+      // Store an entry, unless the cache was invalidated after the generation was read
+      void insert( const std::string&, Entry, uint64_t );
+
+      // Drop every entry
+      void invalidate();
+
+
+      // Maximum number of entries
+      size_t capacity() const { return _capacity; }
+
+      // Current number of entries
+      size_t size();
+  };
+
+
+  /*
+   * Tracks which caches depend on which tables and invalidates them as the tables are written.
+   * Written tables are collected (from the statements and sqlite's update hook) as the writer
+   * connection runs, and the caches are invalidated when the write commits.
+   */
+  class CacheIndex
+  {
+    // Container types
+    typedef std::unordered_multimap< std::string, ResultCache* > TableMap;
+    typedef std::vector< std::string > TableList;
+
+    private:
+      // Caches indexed by the tables they read. Only changed before the index is installed
+      TableMap _tables;
+
+      // Protects the pending list
+      std::mutex _mutex;
+
+      // Tables written since the last flush
+      TableList _pending;
+
+      // Quick check for an empty pending list
+      std::atomic< bool > _dirty;
+
+
+    public:
+      CacheIndex();
+
+      // Register a cache as reading from a table
+      void watch( const std::string&, ResultCache* );
+
+      // Return true if any cache reads from the table
+      bool watching( const std::string& table ) const { return _tables.find( table ) != _tables.end(); }
+
+      // Record that a table has been written
+      void modified( const std::string& );
+
+      // Invalidate the caches reading any table written since the last flush,
+      // unless the connection is still inside a transaction
+      void flush( sqlite3* );
+
+      // Drop the entries of every cache
+      void invalidateAll();
+
+      // Take over the tables another index has recorded as written but not yet flushed
+      void adopt( CacheIndex& );
+
+
+      // Callback to install with sqlite3_update_hook
+      static void updateHook( void*, int, const char*, const char*, sqlite3_int64 );
+  };
+
+}
+
+#endif // SQLW_RESULT_CACHE_H_
+
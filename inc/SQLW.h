@@ -7,8 +7,26 @@
 #define SQLW_VERSION_STRING SQLW_VERSION_MAJOR "." SQLW_VERSION_MINOR
 
 #include "SQLW/Query.h"
+#include "SQLW/QueryPool.h"
 #include "SQLW/Parameter.h"
 #include "SQLW/Database.h"
+#include "SQLW/JsonStream.h"
+#include "SQLW/WriteQueue.h"
+#include "SQLW/ThreadPool.h"
+#include "SQLW/ResultCache.h"
+#include "SQLW/BusyPolicy.h"
+#include "SQLW/PerformanceProfile.h"
+#include "SQLW/Metrics.h"
+#include "SQLW/TypedQuery.h"
+#include "SQLW/ColumnBatch.h"
+#include "SQLW/BindingPlan.h"
+#include "SQLW/KeysetPlan.h"
+#include "SQLW/ResponseEncoder.h"
+#include "SQLW/ResponseArena.h"
+#include "SQLW/BlobStream.h"
+#include "SQLW/QueryRegistry.h"
+#include "SQLW/ShardedDatabase.h"
+#include "SQLW/BulkLoader.h"
 
 #endif // SQLW_PRIMARY_HEADER_H_
 
@@ -0,0 +1,118 @@
+
+#ifndef SQLW_SHARDED_DATABASE_H_
+#define SQLW_SHARDED_DATABASE_H_
+
+#include "Database.h"
+
+#include "CON.h"
+
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <string_view>
+
+
+namespace SQLW
+{
+
+  /*
+   * Spreads one schema over several database files, each opened as its own Database with its own writer.
+   * Every shard loads the same configuration; "shards" lists the files in place of "database_file".
+   *
+   * Each query runs in one of three ways, set in its configuration:
+   *
+   *   shard_key : "param"   Routed to a single shard by the value of that parameter
+   *   fan_out : 1           Run on every shard in parallel, and the rows concatenated in shard order.
+   *                         With merge_key : "column" the rows are merged in that column's order instead,
+   *                         so each shard must return them sorted. merge_order : "desc" for descending.
+   *   neither               Run on the first shard
+   *
+   * Rows are placed by the same hash, so insert them through a routed query or shardFor. Changing the number
+   * of shards moves most keys to a different shard. Fan-out writes are not atomic across shards.
+   */
+  class ShardedDatabase
+  {
+    public:
+      // How a query is run across the shards
+      struct Route
+      {
+        // The parameter that picks the shard. Empty if it isn't routed
+        std::string shardKey;
+
+        // True if it runs on every shard
+        bool fanOut;
+
+        // The column to merge fan-out rows by. Empty to concatenate them
+        std::string mergeKey;
+
+        // True to merge in descending order
+        bool descending;
+      };
+
+    private:
+      // Container types
+      typedef std::vector< Database* > ShardVector;
+      typedef std::unordered_map< std::string, Route > RouteMap;
+
+      // One database per file
+      ShardVector _shards;
+
+      // How each query is run. Queries that run on the first shard aren't listed
+      RouteMap _routes;
+
+      // Runs the fan-out requests for all but the first shard, which runs on the caller's thread
+      ThreadPool* _workers;
+
+
+      // Deletes the shards
+      void close();
+
+
+    public:
+      // Open every shard listed in the configuration
+      explicit ShardedDatabase( const CON::Object& );
+
+      // Closes every shard
+      ~ShardedDatabase();
+
+      // Not copyable or movable
+      ShardedDatabase( const ShardedDatabase& ) = delete;
+      ShardedDatabase( ShardedDatabase&& ) = delete;
+      ShardedDatabase& operator=( const ShardedDatabase& ) = delete;
+      ShardedDatabase& operator=( ShardedDatabase&& ) = delete;
+
+
+      // Return the number of shards
+      size_t size() const { return _shards.size(); }
+
+      // Return a shard, for the manual interface
+      Database& shard( size_t n ) { return *_shards[n]; }
+
+      // Return the shard a key is stored on
+      size_t shardFor( int64_t ) const;
+      size_t shardFor( std::string_view ) const;
+
+
+      // Return the route of a query. Null if it runs on the first shard
+      const Route* route( const char* ) const;
+
+      // Run a job on a fan-out thread. Jobs must not throw
+      void submit( std::function< void() > );
+  };
+
+
+////////////////////////////////////////////////////////////////////////////////
+  // Optional functions for different libraries
+
+#if defined RAPIDJSON_VERSION_STRING
+
+  // Run the query name on the shard picked by its shard key, or on every shard with the rows gathered into one
+  // response. A fan-out fails with the first shard's error if any shard fails.
+  rapidjson::Document executeJson( ShardedDatabase&, const char*, const rapidjson::Document& );
+
+#endif
+
+}
+
+#endif // SQLW_SHARDED_DATABASE_H_
+
@@ -0,0 +1,74 @@
+
+#ifndef SQLW_THREAD_POOL_H_
+#define SQLW_THREAD_POOL_H_
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+
+namespace SQLW
+{
+
+  /*
+   * A fixed set of worker threads running jobs in the order they were submitted.
+   */
+  class ThreadPool
+  {
+    public:
+      // A unit of work
+      typedef std::function< void() > Job;
+
+    private:
+      // Container types
+      typedef std::deque< Job > JobQueue;
+      typedef std::vector< std::thread > ThreadVector;
+
+      // Protects the job queue
+      std::mutex _mutex;
+
+      // Signals the workers that there is a job, or they should stop
+      std::condition_variable _condition;
+
+      // The pending jobs
+      JobQueue _jobs;
+
+      // Set to stop the workers once the queue has drained
+      bool _stop;
+
+      // The workers
+      ThreadVector _threads;
+
+
+      // Worker main loop
+      void run();
+
+
+    public:
+      // Start the number of threads requested
+      explicit ThreadPool( size_t );
+
+      // Finishes all the submitted jobs and stops the threads
+      ~ThreadPool();
+
+      // Not copyable or movable
+      ThreadPool( const ThreadPool& ) = delete;
+      ThreadPool( ThreadPool&& ) = delete;
+      ThreadPool& operator=( const ThreadPool& ) = delete;
+      ThreadPool& operator=( ThreadPool&& ) = delete;
+
+
+      // Queue a job to run on the next free worker. Jobs must not throw
+      void submit( Job );
+
+      // Number of worker threads
+      size_t size() const { return _threads.size(); }
+  };
+
+}
+
+#endif // SQLW_THREAD_POOL_H_
+
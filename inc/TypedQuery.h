@@ -0,0 +1,344 @@
+
+#ifndef SQLW_TYPED_QUERY_H_
+#define SQLW_TYPED_QUERY_H_
+
+#include "Database.h"
+#include "Query.h"
+#include "QueryPool.h"
+#include "QueryRegistry.h"
+
+#include "sqlite3.h"
+
+#include <tuple>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <atomic>
+#include <iostream>
+
+
+namespace SQLW
+{
+
+  // Lists of the parameter and column types of a TypedQuery
+  template < class... TYPES > struct Params {};
+  template < class... TYPES > struct Columns {};
+
+
+  // Binary data, bound and read as a blob rather than text
+  struct BlobView
+  {
+    std::string_view data;
+  };
+
+
+  /*
+   * The sqlite calls for each C++ type, chosen at compile time.
+   * Stored is the type kept once the row has gone, e.g. the string a view is copied into, and store converts to it.
+   */
+  template < class T > struct TypedValue;
+
+  template <> struct TypedValue< int64_t >
+  {
+    typedef int64_t Stored;
+    static Stored store( int64_t v ) { return v; }
+    static bool accepts( Parameter::Type t ) { return t == Parameter::Int; }
+    static int bind( sqlite3_stmt* s, int n, int64_t v ) { return sqlite3_bind_int64( s, n, v ); }
+    static int64_t read( sqlite3_stmt* s, int n ) { return sqlite3_column_int64( s, n ); }
+  };
+
+  template <> struct TypedValue< int >
+  {
+    typedef int Stored;
+    static Stored store( int v ) { return v; }
+    static bool accepts( Parameter::Type t ) { return t == Parameter::Int; }
+    static int bind( sqlite3_stmt* s, int n, int v ) { return sqlite3_bind_int( s, n, v ); }
+    static int read( sqlite3_stmt* s, int n ) { return sqlite3_column_int( s, n ); }
+  };
+
+  template <> struct TypedValue< bool >
+  {
+    typedef bool Stored;
+    static Stored store( bool v ) { return v; }
+    static bool accepts( Parameter::Type t ) { return t == Parameter::Bool; }
+    static int bind( sqlite3_stmt* s, int n, bool v ) { return sqlite3_bind_int( s, n, v ); }
+    static bool read( sqlite3_stmt* s, int n ) { return sqlite3_column_int( s, n ) != 0; }
+  };
+
+  template <> struct TypedValue< double >
+  {
+    typedef double Stored;
+    static Stored store( double v ) { return v; }
+    static bool accepts( Parameter::Type t ) { return t == Parameter::Double; }
+    static int bind( sqlite3_stmt* s, int n, double v ) { return sqlite3_bind_double( s, n, v ); }
+    static double read( sqlite3_stmt* s, int n ) { return sqlite3_column_double( s, n ); }
+  };
+
+  // Views point into sqlite's row buffer, so are only valid until the next row
+  template <> struct TypedValue< std::string_view >
+  {
+    typedef std::string Stored;
+    static Stored store( std::string_view v ) { return std::string( v ); }
+    static bool accepts( Parameter::Type t ) { return t == Parameter::Text; }
+    static int bind( sqlite3_stmt* s, int n, std::string_view v ) { return sqlite3_bind_text( s, n, v.data(), v.size(), SQLITE_STATIC ); }
+    static std::string_view read( sqlite3_stmt* s, int n )
+    {
+      // Reading the blob pointer avoids adding a terminator. It's a no-op conversion for text
+      const char* data = (const char*)sqlite3_column_blob( s, n );
+      return data == nullptr ? std::string_view() : std::string_view( data, sqlite3_column_bytes( s, n ) );
+    }
+  };
+
+  template <> struct TypedValue< std::string >
+  {
+    typedef std::string Stored;
+    static Stored store( const std::string& v ) { return v; }
+    static bool accepts( Parameter::Type t ) { return t == Parameter::Text; }
+    static int bind( sqlite3_stmt* s, int n, const std::string& v ) { return sqlite3_bind_text( s, n, v.data(), v.size(), SQLITE_STATIC ); }
+    static std::string read( sqlite3_stmt* s, int n ) { return std::string( TypedValue< std::string_view >::read( s, n ) ); }
+  };
+
+  template <> struct TypedValue< BlobView >
+  {
+    typedef std::string Stored;
+    static Stored store( BlobView v ) { return std::string( v.data ); }
+    static bool accepts( Parameter::Type t ) { return t == Parameter::Blob; }
+    static int bind( sqlite3_stmt* s, int n, BlobView v ) { return sqlite3_bind_blob( s, n, v.data.data(), v.data.size(), SQLITE_STATIC ); }
+    static BlobView read( sqlite3_stmt* s, int n ) { return BlobView{ TypedValue< std::string_view >::read( s, n ) }; }
+  };
+
+
+  template < class PARAMS, class COLUMNS > class TypedQuery;
+
+  /*
+   * A named query with its parameter and column types fixed at compile time, e.g.
+   *
+   *   TypedQuery< Params< int64_t >, Columns< int64_t, std::string_view > > find( db, "find" );
+   *
+   * Values are bound and read with the matching sqlite calls directly, bypassing the Parameter objects.
+   * The types are checked against those declared in the configuration when it is constructed, and again after
+   * the queries are reloaded. Each call pins the current queries, so a TypedQuery can be kept across reloads.
+   *
+   *   int64_t <-> int, int <-> int, bool <-> bool, double <-> double,
+   *   std::string, std::string_view <-> text, BlobView <-> blob
+   *
+   * Each call checks out a free copy of the query from the pool, so a TypedQuery can be shared by threads.
+   */
+  template < class... PARAMS, class... COLUMNS >
+  class TypedQuery< Params< PARAMS... >, Columns< COLUMNS... > >
+  {
+    public:
+      // A row as it is read. Views are valid until the next row
+      typedef std::tuple< COLUMNS... > Row;
+
+      // A row that owns its data
+      typedef std::tuple< typename TypedValue< COLUMNS >::Stored... > StoredRow;
+
+    private:
+      // The database, and the query found again by each call
+      Database& _database;
+      QueryHandle _handle;
+
+      // Version of the queries the types were last checked against
+      std::atomic< uint64_t > _version;
+
+
+      // Bind every parameter. Returns the first sqlite error, or SQLITE_OK
+      template < size_t... INDEX >
+      static int bindAll( sqlite3_stmt* statement, std::index_sequence< INDEX... >, const PARAMS&... params )
+      {
+        int result = SQLITE_OK;
+        ( ( result = ( result == SQLITE_OK ? TypedValue< PARAMS >::bind( statement, INDEX + 1, params ) : result ) ), ... );
+        (void) statement;
+        return result;
+      }
+
+      // Read every column of the current row
+      template < size_t... INDEX >
+      static Row readAll( sqlite3_stmt* statement, std::index_sequence< INDEX... > )
+      {
+        (void) statement;
+        return Row( TypedValue< COLUMNS >::read( statement, INDEX )... );
+      }
+
+      // Copy a row into one that owns its data
+      template < size_t... INDEX >
+      static StoredRow storeRow( const Row& row, std::index_sequence< INDEX... > )
+      {
+        (void) row;
+        return StoredRow( TypedValue< COLUMNS >::store( std::get< INDEX >( row ) )... );
+      }
+
+      // Build an aggregate from a row
+      template < class STRUCT, size_t... INDEX >
+      static STRUCT makeStruct( const Row& row, std::index_sequence< INDEX... > )
+      {
+        (void) row;
+        return STRUCT{ TypedValue< COLUMNS >::store( std::get< INDEX >( row ) )... };
+      }
+
+      // Returns true if the configured parameter types match
+      template < size_t... INDEX >
+      static bool paramsMatch( const Query& query, std::index_sequence< INDEX... > )
+      {
+        return ( TypedValue< PARAMS >::accepts( query.getParameter( INDEX ).type() ) && ... );
+      }
+
+      // Returns true if the configured column types match
+      template < size_t... INDEX >
+      static bool columnsMatch( const Query& query, std::index_sequence< INDEX... > )
+      {
+        return ( TypedValue< COLUMNS >::accepts( query.getColumn( INDEX ).type() ) && ... );
+      }
+
+      // Throw if the configured types of the query don't match
+      static void validate( QueryPool& );
+
+      // Find the query in the pinned queries, checking its types if they've been reloaded. Null if it no longer exists
+      QueryPool* find( const Database::Pin& );
+
+
+    public:
+      // Check the types against the named query's configuration. Throws if it doesn't exist or they don't match
+      TypedQuery( Database& database, const char* name ) :
+        _database( database ),
+        _handle( database.resolve( name ) ),
+        _version( 0 )
+      {
+        Database::Pin pin( _database );
+        if ( this->find( pin ) == nullptr )
+        {
+          std::cerr << "SQLW Error - Requested query not found: " << name << std::endl;
+          throw std::runtime_error( "Requested query does not exist" );
+        }
+      }
+
+      // Copy another's query
+      TypedQuery( const TypedQuery& other ) :
+        _database( other._database ),
+        _handle( other._handle ),
+        _version( other._version.load() )
+      {
+      }
+
+      TypedQuery& operator=( const TypedQuery& ) = delete;
+
+
+      // Run the query, calling the function with each row. The row's views are only valid during the call.
+      // Fails if the query no longer exists, and throws if it has been reloaded with different types.
+      template < class FUNCTION >
+      Status forEach( FUNCTION&& function, const PARAMS&... params );
+
+      // Run the query and copy every row
+      Status fetch( std::vector< StoredRow >& rows, const PARAMS&... params )
+      {
+        return this->forEach( [&rows]( const Row& row )
+          {
+            rows.push_back( storeRow( row, std::index_sequence_for< COLUMNS... >() ) );
+          }, params... );
+      }
+
+      // Run the query and build an aggregate from each row, with its members in column order
+      template < class STRUCT >
+      Status fetchAs( std::vector< STRUCT >& rows, const PARAMS&... params )
+      {
+        return this->forEach( [&rows]( const Row& row )
+          {
+            rows.push_back( makeStruct< STRUCT >( row, std::index_sequence_for< COLUMNS... >() ) );
+          }, params... );
+      }
+
+      // Run the query, discarding any rows
+      Status execute( const PARAMS&... params )
+      {
+        return this->forEach( []( const Row& ) {}, params... );
+      }
+  };
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+  // Template member definitions
+
+  template < class... PARAMS, class... COLUMNS >
+  void TypedQuery< Params< PARAMS... >, Columns< COLUMNS... > >::validate( QueryPool& pool )
+  {
+    const Query& query = pool.primary();
+
+    if ( query.countParameters() != sizeof...( PARAMS ) || query.countColumns() != sizeof...( COLUMNS ) )
+    {
+      std::cerr << "SQLW Error - Typed query " << pool.name() << " expects " << sizeof...( PARAMS ) << " parameters and "
+                << sizeof...( COLUMNS ) << " columns. Configured with " << query.countParameters() << " and " << query.countColumns() << std::endl;
+      throw std::runtime_error( "Typed query does not match its configuration." );
+    }
+
+    const bool params_ok = paramsMatch( query, std::index_sequence_for< PARAMS... >() );
+    const bool columns_ok = columnsMatch( query, std::index_sequence_for< COLUMNS... >() );
+
+    if ( ! params_ok || ! columns_ok )
+    {
+      std::cerr << "SQLW Error - Typed query " << pool.name() << " has a " << ( params_ok ? "column" : "parameter" )
+                << " type that does not match its configuration" << std::endl;
+      throw std::runtime_error( "Typed query does not match its configuration." );
+    }
+  }
+
+
+  template < class... PARAMS, class... COLUMNS >
+  QueryPool* TypedQuery< Params< PARAMS... >, Columns< COLUMNS... > >::find( const Database::Pin& pin )
+  {
+    QueryPool* pool = pin.find( _handle );
+
+    // Checking twice when threads race after a reload is harmless
+    const uint64_t version = pin.registry().version();
+    if ( pool != nullptr && _version.load() != version )
+    {
+      validate( *pool );
+      _version.store( version );
+    }
+
+    return pool;
+  }
+
+
+  template < class... PARAMS, class... COLUMNS >
+  template < class FUNCTION >
+  Status TypedQuery< Params< PARAMS... >, Columns< COLUMNS... > >::forEach( FUNCTION&& function, const PARAMS&... params )
+  {
+    // Pinned until the rows are read, so a reload can't delete the query under them
+    Database::Pin pin( _database );
+    QueryPool* pool = this->find( pin );
+    if ( pool == nullptr )
+      return Status{ false, "Typed query no longer exists." };
+
+    Query::LockType lock = pool->checkout();
+    Query& query = *lock.mutex();
+    query.ensurePrepared();
+    sqlite3_stmt* statement = query._theStatement;
+
+    if ( bindAll( statement, std::index_sequence_for< PARAMS... >(), params... ) != SQLITE_OK )
+    {
+      sqlite3_clear_bindings( statement );
+      return Status{ false, "Failed to bind typed query parameters." };
+    }
+
+    query.lockConnection();
+
+    while ( query.stepStatement() )
+    {
+      function( readAll( statement, std::index_sequence_for< COLUMNS... >() ) );
+    }
+
+    Status status{ ! query.error(), query.getError() };
+
+    // The bound values belong to the caller
+    query.reset();
+    sqlite3_clear_bindings( statement );
+
+    return status;
+  }
+
+}
+
+#endif // SQLW_TYPED_QUERY_H_
+
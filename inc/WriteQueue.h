@@ -0,0 +1,111 @@
+
+#ifndef SQLW_WRITE_QUEUE_H_
+#define SQLW_WRITE_QUEUE_H_
+
+#include "Query.h"
+
+#include "CON.h"
+
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <chrono>
+
+
+namespace SQLW
+{
+  struct Connection;
+
+
+  /*
+   * Coalesces writes from many threads into group commits.
+   * Writers push a query and a parameter loader, and a single thread runs everything queued
+   * so far on the writer connection inside one transaction. Futures complete once committed.
+   */
+  class WriteQueue
+  {
+    // A queued write
+    struct Item
+    {
+      Query* query;
+      Query::Loader loader;
+      std::promise< Status > promise;
+    };
+
+    // Container types
+    typedef std::unordered_map< std::string, Query* > QueryMap;
+    typedef std::deque< Item > ItemQueue;
+    typedef std::vector< Item > ItemVector;
+
+    private:
+      // The writer connection
+      Connection& _connection;
+
+      // The queue's own copies of the write queries. Only used by the writer thread
+      QueryMap _queries;
+
+      // Maximum number of queued writes before pushing blocks
+      size_t _capacity;
+
+      // Maximum number of writes per transaction
+      size_t _maxBatch;
+
+      // How long to wait for a batch to fill once the first write arrives
+      std::chrono::microseconds _maxDelay;
+
+      // Protects the queue
+      std::mutex _mutex;
+
+      // Signals the writer thread that there is work, or it should stop
+      std::condition_variable _notEmpty;
+
+      // Signals blocked writers that there is space
+      std::condition_variable _notFull;
+
+      // The pending writes
+      ItemQueue _items;
+
+      // Set to stop the writer thread once the queue has drained
+      bool _stop;
+
+      // The writer thread
+      std::thread _thread;
+
+
+      // Writer thread main loop
+      void run();
+
+      // Run a batch in a single transaction and complete the promises
+      void commit( ItemVector& );
+
+
+    public:
+      // Writer connection, list of query configs, queue configuration
+      WriteQueue( Connection&, const CON::Object&, const CON::Object& );
+
+      // Commits anything still queued, stops the writer thread and destroys the queries
+      ~WriteQueue();
+
+      // Not copyable or movable
+      WriteQueue( const WriteQueue& ) = delete;
+      WriteQueue( WriteQueue&& ) = delete;
+      WriteQueue& operator=( const WriteQueue& ) = delete;
+      WriteQueue& operator=( WriteQueue&& ) = delete;
+
+
+      // Queue a write. The loader is called on the writer thread to set the query parameters, so it must
+      // own everything it refers to. Blocks while the queue is full. The future completes after the commit.
+      std::future< Status > push( const char*, Query::Loader );
+
+      // Record the queued executions of the named query in the metrics of its pool. Call before any writes are queued
+      void setMetrics( const std::string&, QueryMetrics* );
+  };
+
+}
+
+#endif // SQLW_WRITE_QUEUE_H_
+
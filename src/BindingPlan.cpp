@@ -0,0 +1,66 @@
+
+#include "BindingPlan.h"
+#include "Query.h"
+
+
+namespace SQLW
+{
+
+  const size_t BindingPlan::npos;
+
+
+  BindingPlan::BindingPlan() :
+    _names(),
+    _index(),
+    _next()
+  {
+  }
+
+
+  void BindingPlan::build( const Query& query )
+  {
+    const size_t count = query.countParameters();
+
+    _index.clear();
+    _names.clear();
+    _next.assign( count, npos );
+
+    // Every name is stored before the map views them, so they don't move afterwards
+    _names.reserve( count );
+    _index.reserve( count );
+    for ( size_t i = 0; i < count; ++i )
+    {
+      _names.push_back( query.getParameter( i ).name() );
+    }
+
+    // Walk backwards so each name's chain runs in parameter order
+    for ( size_t i = count; i-- > 0; )
+    {
+      std::string_view name( _names[i] );
+      IndexMap::iterator found = _index.find( name );
+
+      if ( found != _index.end() )
+      {
+        _next[i] = found->second;
+        found->second = i;
+      }
+      else
+      {
+        _index.insert( std::make_pair( name, i ) );
+      }
+    }
+  }
+
+
+  size_t BindingPlan::find( std::string_view name ) const
+  {
+    IndexMap::const_iterator found = _index.find( name );
+
+    if ( found == _index.end() )
+      return npos;
+    else
+      return found->second;
+  }
+
+}
+
@@ -0,0 +1,128 @@
+
+#include "BlobStream.h"
+#include "Database.h"
+#include "ResultCache.h"
+
+#include <iostream>
+#include <stdexcept>
+
+
+namespace SQLW
+{
+
+  BlobStream::BlobStream( Connection& connection, std::unique_lock< std::mutex > lock, const char* table, const char* column, int64_t row, bool writable ) :
+    _lock( std::move( lock ) ),
+    _connection( &connection ),
+    _blob( nullptr ),
+    _table( table ),
+    _writable( writable )
+  {
+    int result = sqlite3_blob_open( connection.database, "main", table, column, row, ( writable ? 1 : 0 ), &_blob );
+
+    if ( result != SQLITE_OK )
+    {
+      std::cerr << "SQLW Error - Failed to open blob " << table << "." << column << " in row " << row << ": "
+                << sqlite3_errmsg( connection.database ) << std::endl;
+
+      // The handle is set to null on failure, but still needs closing
+      sqlite3_blob_close( _blob );
+      _blob = nullptr;
+      throw std::runtime_error( "Failed to open blob" );
+    }
+  }
+
+
+  BlobStream::BlobStream( BlobStream&& other ) :
+    _lock( std::move( other._lock ) ),
+    _connection( other._connection ),
+    _blob( other._blob ),
+    _table( std::move( other._table ) ),
+    _writable( other._writable )
+  {
+    other._blob = nullptr;
+  }
+
+
+  BlobStream::~BlobStream()
+  {
+    this->close();
+  }
+
+
+  void BlobStream::reopen( int64_t row )
+  {
+    if ( _blob == nullptr || sqlite3_blob_reopen( _blob, row ) != SQLITE_OK )
+    {
+      std::cerr << "SQLW Error - Failed to reopen blob in " << _table << " at row " << row << std::endl;
+      throw std::runtime_error( "Failed to reopen blob" );
+    }
+  }
+
+
+  void BlobStream::close()
+  {
+    if ( _blob == nullptr )
+      return;
+
+    // Closing commits any writes, unless a transaction is open
+    if ( sqlite3_blob_close( _blob ) != SQLITE_OK )
+    {
+      std::cerr << "SQLW Error - Failed to close blob in " << _table << ": " << sqlite3_errmsg( _connection->database ) << std::endl;
+    }
+    _blob = nullptr;
+
+    // Incremental writes don't call the update hook, so the caches are told here
+    if ( _writable && _connection->caches != nullptr )
+    {
+      _connection->caches->modified( _table );
+      _connection->caches->flush( _connection->database );
+    }
+
+    if ( _lock.owns_lock() )
+      _lock.unlock();
+  }
+
+
+  size_t BlobStream::size() const
+  {
+    return ( _blob == nullptr ? 0 : sqlite3_blob_bytes( _blob ) );
+  }
+
+
+  size_t BlobStream::read( void* buffer, size_t length, size_t offset )
+  {
+    const size_t total = this->size();
+    if ( offset >= total )
+      return 0;
+
+    if ( length > total - offset )
+      length = total - offset;
+
+    if ( sqlite3_blob_read( _blob, buffer, length, offset ) != SQLITE_OK )
+    {
+      std::cerr << "SQLW Error - Failed to read blob in " << _table << ": " << sqlite3_errmsg( _connection->database ) << std::endl;
+      throw std::runtime_error( "Failed to read blob" );
+    }
+
+    return length;
+  }
+
+
+  void BlobStream::write( const void* buffer, size_t length, size_t offset )
+  {
+    if ( ! _writable || offset + length > this->size() )
+    {
+      std::cerr << "SQLW Error - Blob write of " << length << " bytes at " << offset << " does not fit in " << _table
+                << " blob of " << this->size() << " bytes" << ( _writable ? "" : ", opened read-only" ) << std::endl;
+      throw std::runtime_error( "Invalid blob write" );
+    }
+
+    if ( sqlite3_blob_write( _blob, buffer, length, offset ) != SQLITE_OK )
+    {
+      std::cerr << "SQLW Error - Failed to write blob in " << _table << ": " << sqlite3_errmsg( _connection->database ) << std::endl;
+      throw std::runtime_error( "Failed to write blob" );
+    }
+  }
+
+}
+
@@ -0,0 +1,996 @@
+
+#include "rapidjson/reader.h"
+#include "rapidjson/memorystream.h"
+
+#include "BulkLoader.h"
+#include "Database.h"
+#include "QueryPool.h"
+#include "QueryRegistry.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <charconv>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace SQLW
+{
+
+  // Number of batches. One being parsed, one being committed and one waiting, so neither thread waits for the other
+  static const size_t BATCH_COUNT = 3;
+
+
+  // A parsed value, ready to bind
+  struct Field
+  {
+    enum Kind : uint8_t { Missing, Null, Integer, Real, Text };
+
+    Kind kind;
+
+    union
+    {
+      int64_t integer;
+      double real;
+
+      // Start of the text in the batch. Offsets stay valid as the text grows
+      size_t offset;
+    };
+
+    // Length of the text
+    size_t length;
+  };
+
+
+  struct BulkLoader::Batch
+  {
+    // Fields per row, one for each parameter
+    const size_t width;
+
+    // The rows, one after the other
+    std::vector< Field > fields;
+
+    // The text of every Text field
+    std::string text;
+
+    // Complete rows
+    size_t rows;
+
+    // Records rejected while parsing
+    uint64_t rejected;
+
+    // Bytes of the file parsed into the batch
+    uint64_t bytes;
+
+    explicit Batch( size_t w ) : width( w ), fields(), text(), rows( 0 ), rejected( 0 ), bytes( 0 ) {}
+
+    // Empty the batch, keeping its memory
+    void clear()
+    {
+      fields.clear();
+      text.clear();
+      rows = 0;
+      rejected = 0;
+      bytes = 0;
+    }
+
+    // Add a row with every field missing, and return it
+    Field* beginRow()
+    {
+      fields.resize( ( rows + 1 ) * width, Field() );
+      return &fields[ rows * width ];
+    }
+
+    // Keep the row if it parsed and every field was set. Otherwise drop it, and any text it added after the mark
+    void finishRow( bool parsed, size_t mark )
+    {
+      for ( size_t n = rows * width; parsed && n < fields.size(); ++n )
+      {
+        parsed = ( fields[n].kind != Field::Missing );
+      }
+
+      if ( parsed )
+      {
+        rows += 1;
+      }
+      else
+      {
+        fields.resize( rows * width );
+        text.resize( mark );
+        rejected += 1;
+      }
+    }
+  };
+
+
+  // Store text in a field
+  static void setText( Field& field, std::string& text, const char* data, size_t length )
+  {
+    field.kind = Field::Text;
+    field.offset = text.size();
+    field.length = length;
+    text.append( data, length );
+  }
+
+
+  /*
+   * SAX handler that fills the fields of a row from one NDJSON record, matching the members to parameters by name.
+   * Members that aren't parameters are skipped, along with anything nested inside them.
+   * Returning false stops the parse, which rejects the record.
+   */
+  class RecordHandler : public rapidjson::BaseReaderHandler< rapidjson::UTF8<>, RecordHandler >
+  {
+    private:
+      // Finds the parameters for each member
+      const BindingPlan& _plan;
+
+      // The query, for the parameter types
+      const Query& _query;
+
+      // The row being filled, and where its text goes
+      Field* _row;
+      std::string& _text;
+
+      // Nesting depth. Parameters are the members at depth 1
+      unsigned _depth;
+
+      // First parameter for the current member, or npos to skip it
+      size_t _current;
+
+
+      // Set the current member's fields. The function returns false if the value is the wrong type
+      template < class FUNCTION >
+      bool load( FUNCTION&& function )
+      {
+        if ( _depth == 0 )
+          return false;
+
+        if ( _depth > 1 )
+          return true;
+
+        for ( size_t n = _current; n != BindingPlan::npos; n = _plan.next( n ) )
+        {
+          if ( ! function( _row[n], _query.getParameter( n ).type() ) )
+            return false;
+        }
+        return true;
+      }
+
+      // Start a nested value. It can't be a parameter
+      bool nest()
+      {
+        if ( _depth == 1 && _current != BindingPlan::npos )
+          return false;
+
+        _depth += 1;
+        return _depth > 1;
+      }
+
+
+    public:
+      RecordHandler( const BindingPlan& plan, const Query& query, Field* row, std::string& text ) :
+        _plan( plan ),
+        _query( query ),
+        _row( row ),
+        _text( text ),
+        _depth( 0 ),
+        _current( BindingPlan::npos )
+      {
+      }
+
+
+      bool Null()
+      {
+        return this->load( []( Field& field, Parameter::Type )
+          {
+            field.kind = Field::Null;
+            return true;
+          } );
+      }
+
+      bool Bool( bool value )
+      {
+        return this->load( [value]( Field& field, Parameter::Type type )
+          {
+            if ( type != Parameter::Bool )
+              return false;
+            field.kind = Field::Integer;
+            field.integer = value;
+            return true;
+          } );
+      }
+
+      bool Int( int value ) { return this->Int64( value ); }
+      bool Uint( unsigned value ) { return this->Int64( value ); }
+
+      // Integers also fill double parameters, as files often write whole numbers without a decimal point
+      bool Int64( int64_t value )
+      {
+        return this->load( [value]( Field& field, Parameter::Type type )
+          {
+            if ( type == Parameter::Int )
+            {
+              field.kind = Field::Integer;
+              field.integer = value;
+            }
+            else if ( type == Parameter::Double )
+            {
+              field.kind = Field::Real;
+              field.real = static_cast< double >( value );
+            }
+            else
+              return false;
+            return true;
+          } );
+      }
+
+      bool Uint64( uint64_t value )
+      {
+        if ( value > static_cast< uint64_t >( std::numeric_limits< int64_t >::max() ) )
+          return this->Double( static_cast< double >( value ) );
+        else
+          return this->Int64( static_cast< int64_t >( value ) );
+      }
+
+      bool Double( double value )
+      {
+        return this->load( [value]( Field& field, Parameter::Type type )
+          {
+            if ( type != Parameter::Double )
+              return false;
+            field.kind = Field::Real;
+            field.real = value;
+            return true;
+          } );
+      }
+
+      bool String( const char* value, rapidjson::SizeType length, bool )
+      {
+        std::string& text = _text;
+        return this->load( [value, length, &text]( Field& field, Parameter::Type type )
+          {
+            if ( type != Parameter::Text && type != Parameter::Blob )
+              return false;
+            setText( field, text, value, length );
+            return true;
+          } );
+      }
+
+      bool Key( const char* name, rapidjson::SizeType length, bool )
+      {
+        if ( _depth == 1 )
+          _current = _plan.find( std::string_view( name, length ) );
+        return true;
+      }
+
+      bool StartObject()
+      {
+        if ( _depth == 0 )
+        {
+          _depth = 1;
+          return true;
+        }
+        return this->nest();
+      }
+
+      bool EndObject( rapidjson::SizeType )
+      {
+        _depth -= 1;
+        return true;
+      }
+
+      bool StartArray() { return this->nest(); }
+
+      bool EndArray( rapidjson::SizeType )
+      {
+        _depth -= 1;
+        return true;
+      }
+  };
+
+
+  // Read one CSV field, leaving the position after the character that ended it. Quoted fields are unescaped into
+  // the scratch string. Returns ',' or '\n' for the character that ended it, or '\0' at the end of the file.
+  static char csvField( const char*& p, const char* end, std::string& scratch, std::string_view& value, bool& quoted )
+  {
+    quoted = ( p < end && *p == '"' );
+
+    if ( quoted )
+    {
+      scratch.clear();
+      ++p;
+      while ( p < end )
+      {
+        const char* run = p;
+        while ( p < end && *p != '"' )
+          ++p;
+        scratch.append( run, p - run );
+
+        // A doubled quote is a literal quote. A single one closes the field
+        if ( p + 1 < end && p[1] == '"' )
+        {
+          scratch.push_back( '"' );
+          p += 2;
+        }
+        else
+        {
+          ++p;
+          break;
+        }
+      }
+      value = scratch;
+
+      // Anything between the closing quote and the separator is ignored
+      while ( p < end && *p != ',' && *p != '\n' )
+        ++p;
+    }
+    else
+    {
+      const char* start = p;
+      while ( p < end && *p != ',' && *p != '\n' )
+        ++p;
+
+      value = std::string_view( start, p - start );
+      if ( ! value.empty() && value.back() == '\r' )
+        value.remove_suffix( 1 );
+    }
+
+    if ( p >= end )
+      return '\0';
+
+    return *p++;
+  }
+
+
+  // Convert a CSV field to the parameter's type. Empty, unquoted fields are null. Returns false if it doesn't convert
+  static bool csvValue( std::string_view value, bool quoted, Parameter::Type type, Field& field, std::string& text )
+  {
+    if ( value.empty() && ! quoted )
+    {
+      field.kind = Field::Null;
+      return true;
+    }
+
+    const char* end = value.data() + value.size();
+    switch( type )
+    {
+      case Parameter::Int :
+        field.kind = Field::Integer;
+        {
+          std::from_chars_result result = std::from_chars( value.data(), end, field.integer );
+          return result.ec == std::errc() && result.ptr == end;
+        }
+
+      case Parameter::Double :
+        field.kind = Field::Real;
+        {
+          std::from_chars_result result = std::from_chars( value.data(), end, field.real );
+          return result.ec == std::errc() && result.ptr == end;
+        }
+
+      case Parameter::Bool :
+        field.kind = Field::Integer;
+        if ( value == "1" || value == "true" )
+          field.integer = 1;
+        else if ( value == "0" || value == "false" )
+          field.integer = 0;
+        else
+          return false;
+        return true;
+
+      case Parameter::Text :
+      case Parameter::Blob :
+        setText( field, text, value.data(), value.size() );
+        return true;
+    }
+    return false;
+  }
+
+
+  BulkLoader::Options::Options() :
+    transactionRows( 50000 ),
+    rowsPerStatement( 1 ),
+    header( true ),
+    reportInterval( 1000 ),
+    progress()
+  {
+  }
+
+
+  BulkLoader::BulkLoader( Database& db, const char* name, const Options& options ) :
+    _database( db ),
+    _handle( db.resolve( name ) ),
+    _version( 0 ),
+    _pool( nullptr ),
+    _options( options ),
+    _multiStatement( nullptr ),
+    _multiConnection( nullptr ),
+    _multiRows( 1 ),
+    _mutex(),
+    _filled(),
+    _emptied(),
+    _full(),
+    _free(),
+    _parsing( nullptr ),
+    _finished( false ),
+    _failure(),
+    _progress( Progress{ 0, 0, 0, 0.0 } ),
+    _start(),
+    _lastReport()
+  {
+    if ( _options.transactionRows == 0 || _options.rowsPerStatement == 0 )
+    {
+      std::cerr << "SQLW Error - Bulk load transaction and statement sizes must be greater than zero." << std::endl;
+      throw std::runtime_error( "Invalid bulk load options." );
+    }
+
+    Database::Pin pin( _database );
+    QueryPool* pool = pin.find( _handle );
+    if ( pool == nullptr )
+    {
+      std::cerr << "SQLW Error - Requested query not found: " << name << std::endl;
+      throw std::runtime_error( "Requested query does not exist" );
+    }
+
+    try
+    {
+      this->setup( *pool );
+    }
+    catch ( ... )
+    {
+      // The destructor won't run
+      this->clear();
+      throw;
+    }
+    _version = pin.registry().version();
+  }
+
+
+  void BulkLoader::setup( QueryPool& pool )
+  {
+    const char* name = pool.name().c_str();
+
+    // Drop what was built for the query's previous configuration
+    this->clear();
+    _multiRows = 1;
+
+    Query& query = pool.primary();
+    query.ensurePrepared();
+
+    if ( query.readOnly() )
+    {
+      std::cerr << "SQLW Error - Bulk loads need a query that writes: " << name << std::endl;
+      throw std::runtime_error( "Bulk load query is read-only." );
+    }
+
+    const size_t width = query.countParameters();
+
+    if ( _options.rowsPerStatement > 1 && width > 0 )
+    {
+      // Find the tuple after the last VALUES, allowing for nested brackets
+      const std::string& text = query._statementText;
+      std::string upper( text );
+      for ( std::string::iterator it = upper.begin(); it != upper.end(); ++it )
+      {
+        *it = std::toupper( static_cast< unsigned char >( *it ) );
+      }
+
+      size_t open = upper.rfind( "VALUES" );
+      open = ( open == std::string::npos ? open : text.find( '(', open ) );
+
+      size_t close = std::string::npos;
+      size_t placeholders = 0;
+      bool numbered = false;
+      for ( size_t i = open, depth = 0; open != std::string::npos && i < text.size(); ++i )
+      {
+        if ( text[i] == '(' )
+          depth += 1;
+        else if ( text[i] == ')' && --depth == 0 )
+        {
+          close = i;
+          break;
+        }
+        else if ( text[i] == '?' )
+        {
+          placeholders += 1;
+          numbered = numbered || ( i + 1 < text.size() && std::isdigit( static_cast< unsigned char >( text[i+1] ) ) );
+        }
+      }
+
+      if ( close == std::string::npos || placeholders != width || numbered )
+      {
+        std::cerr << "SQLW Error - Query " << name << " needs a VALUES tuple of " << width
+                  << " anonymous '?' parameters to insert several rows per statement" << std::endl;
+        throw std::runtime_error( "Bulk load statement can't be extended." );
+      }
+
+      std::lock_guard< std::mutex > lock( query._connection.mutex );
+      sqlite3* database = query._connection.database;
+
+      // Stay within sqlite's limit on the number of parameters
+      const size_t limit = sqlite3_limit( database, SQLITE_LIMIT_VARIABLE_NUMBER, -1 );
+      _multiRows = std::max< size_t >( 1, std::min( _options.rowsPerStatement, limit / width ) );
+
+      if ( _multiRows > 1 )
+      {
+        const std::string tuple = text.substr( open, close - open + 1 );
+
+        std::string statement = text.substr( 0, close + 1 );
+        statement.reserve( text.size() + ( tuple.size() + 2 ) * ( _multiRows - 1 ) );
+        for ( size_t r = 1; r < _multiRows; ++r )
+        {
+          statement += ", ";
+          statement += tuple;
+        }
+        statement += text.substr( close + 1 );
+
+        if ( sqlite3_prepare_v2( database, statement.c_str(), -1, &_multiStatement, nullptr ) != SQLITE_OK ||
+             static_cast< size_t >( sqlite3_bind_parameter_count( _multiStatement ) ) != _multiRows * width )
+        {
+          std::cerr << "SQLW Error - Failed to prepare the multi-row statement for query " << name << " : "
+                    << sqlite3_errmsg( database ) << std::endl;
+          sqlite3_finalize( _multiStatement );
+          _multiStatement = nullptr;
+          throw std::runtime_error( "Bulk load statement can't be extended." );
+        }
+        _multiConnection = &query._connection;
+      }
+    }
+
+    for ( size_t i = 0; i < BATCH_COUNT; ++i )
+    {
+      _free.push_back( new Batch( width ) );
+    }
+  }
+
+
+  void BulkLoader::clear()
+  {
+    // The connection outlives a reload, so the statement can still be finalised after the query has gone
+    if ( _multiStatement != nullptr )
+    {
+      std::lock_guard< std::mutex > lock( _multiConnection->mutex );
+      sqlite3_finalize( _multiStatement );
+      _multiStatement = nullptr;
+      _multiConnection = nullptr;
+    }
+
+    for ( BatchQueue::iterator it = _free.begin(); it != _free.end(); ++it )
+    {
+      delete (*it);
+    }
+    _free.clear();
+  }
+
+
+  BulkLoader::~BulkLoader()
+  {
+    this->clear();
+  }
+
+
+  BulkLoader::Progress BulkLoader::load( const std::string& path, Format format )
+  {
+    // Pinned for the whole load, so a reload can't delete the query while it's in use
+    Database::Pin pin( _database );
+    _pool = pin.find( _handle );
+    if ( _pool == nullptr )
+    {
+      std::cerr << "SQLW Error - Bulk load query no longer exists: " << _handle.name() << std::endl;
+      throw std::runtime_error( "Bulk load query does not exist." );
+    }
+
+    // A reload may have changed the statement or its parameters
+    if ( pin.registry().version() != _version )
+    {
+      this->setup( *_pool );
+      _version = pin.registry().version();
+    }
+
+    int file = ::open( path.c_str(), O_RDONLY );
+    struct stat info;
+    if ( file < 0 || ::fstat( file, &info ) != 0 )
+    {
+      std::cerr << "SQLW Error - Failed to open bulk load file: " << path << " : " << std::strerror( errno ) << std::endl;
+      if ( file >= 0 )
+        ::close( file );
+      throw std::runtime_error( "Failed to open bulk load file." );
+    }
+
+    // The whole file is mapped and read once from start to end
+    const size_t size = info.st_size;
+    void* mapped = nullptr;
+    if ( size > 0 )
+    {
+      mapped = ::mmap( nullptr, size, PROT_READ, MAP_PRIVATE, file, 0 );
+      if ( mapped == MAP_FAILED )
+      {
+        std::cerr << "SQLW Error - Failed to map bulk load file: " << path << " : " << std::strerror( errno ) << std::endl;
+        ::close( file );
+        throw std::runtime_error( "Failed to map bulk load file." );
+      }
+      ::madvise( mapped, size, MADV_SEQUENTIAL );
+    }
+    ::close( file );
+
+    const char* begin = static_cast< const char* >( mapped );
+    const char* end = begin + size;
+
+    // Keep the query for the whole load
+    Query::LockType query_lock = _pool->checkout();
+    Query& query = *query_lock.mutex();
+    query.ensurePrepared();
+
+    {
+      std::lock_guard< std::mutex > lock( _mutex );
+      _finished = false;
+      _failure.clear();
+      _progress = Progress{ 0, 0, 0, 0.0 };
+      _start = _lastReport = std::chrono::steady_clock::now();
+    }
+
+    std::thread writer( &BulkLoader::run, this, std::ref( query ) );
+
+    Batch* last = nullptr;
+    try
+    {
+      last = ( format == CSV ? this->parseCsv( query, begin, end ) : this->parseNdjson( query, begin, end ) );
+    }
+    catch ( ... )
+    {
+      {
+        std::lock_guard< std::mutex > lock( _mutex );
+        _failure = "Exception while parsing.";
+        _finished = true;
+      }
+      _filled.notify_one();
+      writer.join();
+
+      // The parser's batch would otherwise be lost, leaving later loads a batch short
+      if ( _parsing != nullptr )
+      {
+        _parsing->clear();
+        _free.push_back( _parsing );
+        _parsing = nullptr;
+      }
+
+      if ( mapped != nullptr )
+        ::munmap( mapped, size );
+      throw;
+    }
+
+    // Commit whatever is left, then let the writer finish
+    {
+      std::lock_guard< std::mutex > lock( _mutex );
+      if ( last != nullptr )
+        _full.push_back( last );
+      _parsing = nullptr;
+      _finished = true;
+    }
+    _filled.notify_one();
+    writer.join();
+
+    if ( mapped != nullptr )
+      ::munmap( mapped, size );
+
+    if ( ! _failure.empty() )
+    {
+      std::cerr << "SQLW Error - Bulk load of " << path << " stopped after " << _progress.rows << " rows: " << _failure << std::endl;
+      throw std::runtime_error( "Bulk load failed." );
+    }
+
+    return _progress;
+  }
+
+
+  BulkLoader::Batch* BulkLoader::exchange( Batch* batch )
+  {
+    std::unique_lock< std::mutex > lock( _mutex );
+    if ( batch != nullptr )
+    {
+      _full.push_back( batch );
+      _filled.notify_one();
+    }
+    _parsing = nullptr;
+
+    _emptied.wait( lock, [this]() { return ! _free.empty() || ! _failure.empty(); } );
+
+    // Stop parsing once a transaction has failed
+    if ( ! _failure.empty() )
+      return nullptr;
+
+    _parsing = _free.front();
+    _free.pop_front();
+    return _parsing;
+  }
+
+
+  BulkLoader::Batch* BulkLoader::parseNdjson( Query& query, const char* begin, const char* end )
+  {
+    const BindingPlan& plan = _pool->plan();
+    rapidjson::Reader reader;
+
+    Batch* batch = this->exchange( nullptr );
+    const char* line = begin;
+    while ( batch != nullptr && line < end )
+    {
+      const char* newline = static_cast< const char* >( std::memchr( line, '\n', end - line ) );
+      const char* line_end = ( newline == nullptr ? end : newline );
+      const char* next = ( newline == nullptr ? end : newline + 1 );
+
+      // Skip blank lines
+      const char* first = line;
+      while ( first < line_end && std::isspace( static_cast< unsigned char >( *first ) ) )
+        ++first;
+
+      if ( first < line_end )
+      {
+        size_t mark = batch->text.size();
+        RecordHandler handler( plan, query, batch->beginRow(), batch->text );
+
+        rapidjson::MemoryStream stream( first, line_end - first );
+        bool parsed = ! reader.Parse( stream, handler ).IsError();
+
+        batch->finishRow( parsed, mark );
+      }
+
+      batch->bytes += next - line;
+      line = next;
+
+      if ( batch->rows >= _options.transactionRows )
+        batch = this->exchange( batch );
+    }
+
+    return batch;
+  }
+
+
+  BulkLoader::Batch* BulkLoader::parseCsv( Query& query, const char* begin, const char* end )
+  {
+    const BindingPlan& plan = _pool->plan();
+    std::string scratch;
+    std::string_view value;
+    bool quoted;
+
+    // The parameters each column fills
+    std::vector< std::vector< size_t > > columns;
+
+    const char* p = begin;
+    if ( _options.header )
+    {
+      char separator = ',';
+      while ( p < end && separator == ',' )
+      {
+        separator = csvField( p, end, scratch, value, quoted );
+
+        columns.push_back( std::vector< size_t >() );
+        for ( size_t n = plan.find( value ); n != BindingPlan::npos; n = plan.next( n ) )
+        {
+          columns.back().push_back( n );
+        }
+      }
+    }
+    else
+    {
+      for ( size_t n = 0; n < query.countParameters(); ++n )
+      {
+        columns.push_back( std::vector< size_t >( 1, n ) );
+      }
+    }
+
+    Batch* batch = this->exchange( nullptr );
+    if ( batch != nullptr )
+      batch->bytes += p - begin;
+
+    while ( batch != nullptr && p < end )
+    {
+      const char* record = p;
+
+      // Skip blank lines
+      if ( *p == '\n' || ( *p == '\r' && p + 1 < end && p[1] == '\n' ) )
+      {
+        p += ( *p == '\n' ? 1 : 2 );
+        batch->bytes += p - record;
+        continue;
+      }
+
+      size_t mark = batch->text.size();
+      Field* row = batch->beginRow();
+      bool parsed = true;
+
+      char separator;
+      size_t column = 0;
+      do
+      {
+        separator = csvField( p, end, scratch, value, quoted );
+
+        // Extra fields reject the record
+        parsed = parsed && column < columns.size();
+        for ( size_t c = 0; parsed && c < columns[ column ].size(); ++c )
+        {
+          size_t n = columns[ column ][ c ];
+          parsed = csvValue( value, quoted, query.getParameter( n ).type(), row[n], batch->text );
+        }
+        column += 1;
+      }
+      while ( separator == ',' );
+
+      batch->finishRow( parsed, mark );
+      batch->bytes += p - record;
+
+      if ( batch->rows >= _options.transactionRows )
+        batch = this->exchange( batch );
+    }
+
+    return batch;
+  }
+
+
+  void BulkLoader::run( Query& query )
+  {
+    std::unique_lock< std::mutex > lock( _mutex );
+    while ( true )
+    {
+      _filled.wait( lock, [this]() { return _finished || ! _full.empty(); } );
+
+      if ( _full.empty() )
+        break;
+
+      Batch* batch = _full.front();
+      _full.pop_front();
+
+      // After a failure the remaining batches are just handed back
+      if ( _failure.empty() )
+      {
+        lock.unlock();
+
+        std::string error;
+        uint64_t failed = this->commit( query, *batch, error );
+
+        lock.lock();
+
+        if ( ! error.empty() )
+        {
+          _failure = error;
+        }
+        else
+        {
+          _progress.rows += batch->rows - failed;
+          _progress.rejected += batch->rejected + failed;
+          _progress.bytes += batch->bytes;
+          this->report( false );
+        }
+      }
+
+      batch->clear();
+      _free.push_back( batch );
+      _emptied.notify_one();
+    }
+
+    this->report( true );
+  }
+
+
+  uint64_t BulkLoader::commit( Query& query, Batch& batch, std::string& error )
+  {
+    Connection& connection = query._connection;
+    std::lock_guard< std::mutex > connection_lock( connection.mutex );
+
+    if ( ! transaction( connection, "BEGIN IMMEDIATE;" ) )
+    {
+      error = "Failed to begin bulk load transaction.";
+      return 0;
+    }
+
+    uint64_t failed = 0;
+    size_t row = 0;
+    while ( row < batch.rows && ! sqlite3_get_autocommit( connection.database ) )
+    {
+      // Full groups go through the multi-row statement, and the remainder one at a time
+      sqlite3_stmt* statement = query._theStatement;
+      size_t count = 1;
+      if ( _multiStatement != nullptr && batch.rows - row >= _multiRows )
+      {
+        statement = _multiStatement;
+        count = _multiRows;
+      }
+
+      for ( size_t i = 0; i < count; ++i )
+      {
+        this->bindRow( query, statement, batch, row + i, static_cast< int >( i * batch.width + 1 ) );
+      }
+
+      int result;
+      while ( ( result = sqlite3_step( statement ) ) == SQLITE_ROW );
+
+      if ( result != SQLITE_DONE )
+      {
+        // Only the first failure of each transaction is logged
+        if ( failed == 0 )
+          std::cerr << "SQLW Error - Bulk load row rejected: " << sqlite3_errmsg( connection.database ) << std::endl;
+        failed += count;
+      }
+
+      sqlite3_reset( statement );
+      row += count;
+    }
+
+    // The text bound to both statements belongs to the batch
+    sqlite3_clear_bindings( query._theStatement );
+    if ( _multiStatement != nullptr )
+      sqlite3_clear_bindings( _multiStatement );
+
+    // Some errors (e.g. disk full) roll back the whole transaction, not just the statement
+    if ( sqlite3_get_autocommit( connection.database ) )
+    {
+      error = "Bulk load transaction was rolled back.";
+    }
+    else if ( ! transaction( connection, "COMMIT;" ) )
+    {
+      transaction( connection, "ROLLBACK;" );
+      error = "Failed to commit bulk load transaction.";
+    }
+
+    return failed;
+  }
+
+
+  void BulkLoader::bindRow( Query& query, sqlite3_stmt* statement, const Batch& batch, size_t row, int first )
+  {
+    const Field* fields = &batch.fields[ row * batch.width ];
+
+    for ( size_t n = 0; n < batch.width; ++n )
+    {
+      const Field& field = fields[n];
+      const int index = first + static_cast< int >( n );
+
+      switch( field.kind )
+      {
+        case Field::Missing :
+        case Field::Null :
+          sqlite3_bind_null( statement, index );
+          break;
+
+        case Field::Integer :
+          sqlite3_bind_int64( statement, index, field.integer );
+          break;
+
+        case Field::Real :
+          sqlite3_bind_double( statement, index, field.real );
+          break;
+
+        case Field::Text :
+          // The batch isn't touched until the transaction has been committed, so the text isn't copied
+          if ( query.getParameter( n ).type() == Parameter::Blob )
+            sqlite3_bind_blob( statement, index, batch.text.data() + field.offset, field.length, SQLITE_STATIC );
+          else
+            sqlite3_bind_text( statement, index, batch.text.data() + field.offset, field.length, SQLITE_STATIC );
+          break;
+      }
+    }
+  }
+
+
+  void BulkLoader::report( bool force )
+  {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    _progress.seconds = std::chrono::duration< double >( now - _start ).count();
+
+    if ( _options.progress && ( force || now - _lastReport >= _options.reportInterval ) )
+    {
+      _lastReport = now;
+      _options.progress( _progress );
+    }
+  }
+
+}
+
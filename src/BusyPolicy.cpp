@@ -0,0 +1,98 @@
+
+#include "BusyPolicy.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+
+namespace SQLW
+{
+
+  BusyPolicy::BusyPolicy() :
+    _retries( 10 ),
+    _initialDelay( 100 ),
+    _maxDelay( 10000 ),
+    _busyEvents( 0 ),
+    _failures( 0 ),
+    _waitTime( 0 )
+  {
+  }
+
+
+  BusyPolicy::BusyPolicy( const BusyPolicy& defaults, const CON::Object& config ) :
+    _retries( defaults._retries ),
+    _initialDelay( defaults._initialDelay ),
+    _maxDelay( defaults._maxDelay ),
+    _busyEvents( 0 ),
+    _failures( 0 ),
+    _waitTime( 0 )
+  {
+    this->configure( config );
+  }
+
+
+  void BusyPolicy::configure( const CON::Object& config )
+  {
+    if ( config.has( "busy_retries" ) )
+    {
+      _retries = config["busy_retries"].asInt();
+    }
+
+    if ( config.has( "busy_delay_us" ) )
+    {
+      _initialDelay = config["busy_delay_us"].asInt();
+    }
+
+    if ( config.has( "busy_max_delay_us" ) )
+    {
+      _maxDelay = config["busy_max_delay_us"].asInt();
+    }
+
+    if ( _initialDelay == 0 || _maxDelay < _initialDelay )
+    {
+      std::cerr << "SQLW Error - Invalid busy delays: " << _initialDelay << "us to " << _maxDelay << "us" << std::endl;
+      throw std::runtime_error( "Invalid busy delays." );
+    }
+  }
+
+
+  bool BusyPolicy::configured( const CON::Object& config )
+  {
+    return config.has( "busy_retries" ) || config.has( "busy_delay_us" ) || config.has( "busy_max_delay_us" );
+  }
+
+
+  bool BusyPolicy::wait( unsigned int attempt )
+  {
+    _busyEvents.fetch_add( 1, std::memory_order_relaxed );
+
+    if ( attempt >= _retries )
+    {
+      _failures.fetch_add( 1, std::memory_order_relaxed );
+      return false;
+    }
+
+    // Double the delay each attempt, stopping at the maximum
+    uint64_t delay = _maxDelay;
+    if ( attempt < 32 )
+    {
+      delay = std::min< uint64_t >( (uint64_t)_initialDelay << attempt, _maxDelay );
+    }
+
+    // Sleep for somewhere between half and all of it
+    thread_local std::minstd_rand generator( std::random_device{}() );
+    delay = delay / 2 + generator() % ( delay / 2 + 1 );
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for( std::chrono::microseconds( delay ) );
+    uint64_t waited = std::chrono::duration_cast< std::chrono::microseconds >( std::chrono::steady_clock::now() - start ).count();
+
+    _waitTime.fetch_add( waited, std::memory_order_relaxed );
+    return true;
+  }
+
+}
+
@@ -0,0 +1,309 @@
+
+#include "ColumnBatch.h"
+#include "Query.h"
+
+#include <utility>
+
+
+namespace SQLW
+{
+
+  // Set or clear a bit in a bit-packed buffer, growing it as needed
+  static void appendBit( std::vector< uint8_t >& bits, size_t index, bool value )
+  {
+    if ( index % 8 == 0 )
+      bits.push_back( 0 );
+
+    if ( value )
+      bits.back() |= ( 1 << ( index % 8 ) );
+  }
+
+
+  ColumnBatch::ColumnBatch( const Query& query ) :
+    _columns( query.countColumns() ),
+    _rows( 0 )
+  {
+    for ( size_t i = 0; i < _columns.size(); ++i )
+    {
+      _columns[i].name = query.getColumn( i ).name();
+      _columns[i].type = query.getColumn( i ).type();
+    }
+    this->clear();
+  }
+
+
+  void ColumnBatch::clear()
+  {
+    for ( ColumnVector::iterator it = _columns.begin(); it != _columns.end(); ++it )
+    {
+      it->nullCount = 0;
+      it->validity.clear();
+      it->ints.clear();
+      it->doubles.clear();
+      it->bits.clear();
+      it->offsets.clear();
+      it->data.clear();
+
+      if ( it->type == Parameter::Text || it->type == Parameter::Blob )
+        it->offsets.push_back( 0 );
+    }
+    _rows = 0;
+  }
+
+
+  void ColumnBatch::reserve( size_t rows )
+  {
+    for ( ColumnVector::iterator it = _columns.begin(); it != _columns.end(); ++it )
+    {
+      it->validity.reserve( ( rows + 7 ) / 8 );
+
+      switch( it->type )
+      {
+        case Parameter::Int :
+          it->ints.reserve( rows );
+          break;
+
+        case Parameter::Double :
+          it->doubles.reserve( rows );
+          break;
+
+        case Parameter::Bool :
+          it->bits.reserve( ( rows + 7 ) / 8 );
+          break;
+
+        case Parameter::Text :
+        case Parameter::Blob :
+          it->offsets.reserve( rows + 1 );
+          break;
+      }
+    }
+  }
+
+
+  void ColumnBatch::append( sqlite3_stmt* statement )
+  {
+    int index = 0;
+    for ( ColumnVector::iterator it = _columns.begin(); it != _columns.end(); ++it, ++index )
+    {
+      // Nulls still take a slot in the value buffers
+      bool valid = ( sqlite3_column_type( statement, index ) != SQLITE_NULL );
+      appendBit( it->validity, _rows, valid );
+      if ( ! valid )
+        it->nullCount += 1;
+
+      switch( it->type )
+      {
+        case Parameter::Int :
+          it->ints.push_back( sqlite3_column_int64( statement, index ) );
+          break;
+
+        case Parameter::Double :
+          it->doubles.push_back( sqlite3_column_double( statement, index ) );
+          break;
+
+        case Parameter::Bool :
+          appendBit( it->bits, _rows, sqlite3_column_int( statement, index ) != 0 );
+          break;
+
+        case Parameter::Text :
+        case Parameter::Blob :
+          {
+            // The blob pointer is the raw bytes for both, without a terminator
+            const char* data = (const char*)sqlite3_column_blob( statement, index );
+            if ( data != nullptr )
+              it->data.insert( it->data.end(), data, data + sqlite3_column_bytes( statement, index ) );
+            it->offsets.push_back( it->data.size() );
+          }
+          break;
+      }
+    }
+    _rows += 1;
+  }
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+  // Arrow export
+
+  // Owns everything the exported schema points to
+  struct SchemaData
+  {
+    std::vector< std::string > names;
+    std::vector< ArrowSchema > children;
+    std::vector< ArrowSchema* > pointers;
+  };
+
+  // Owns everything the exported array points to
+  struct ArrayData
+  {
+    ColumnBatch::ColumnVector columns;
+    std::vector< std::vector< const void* > > buffers;
+    std::vector< ArrowArray > children;
+    std::vector< ArrowArray* > pointers;
+    const void* buffer;
+  };
+
+
+  // Children are owned by the parent, so there's nothing to free
+  static void releaseChildSchema( ArrowSchema* schema )
+  {
+    schema->release = nullptr;
+  }
+
+  static void releaseChildArray( ArrowArray* array )
+  {
+    array->release = nullptr;
+  }
+
+
+  static void releaseSchema( ArrowSchema* schema )
+  {
+    for ( int64_t i = 0; i < schema->n_children; ++i )
+    {
+      if ( schema->children[i]->release != nullptr )
+        schema->children[i]->release( schema->children[i] );
+    }
+    delete static_cast< SchemaData* >( schema->private_data );
+    schema->release = nullptr;
+  }
+
+  static void releaseArray( ArrowArray* array )
+  {
+    for ( int64_t i = 0; i < array->n_children; ++i )
+    {
+      if ( array->children[i]->release != nullptr )
+        array->children[i]->release( array->children[i] );
+    }
+    delete static_cast< ArrayData* >( array->private_data );
+    array->release = nullptr;
+  }
+
+
+  // Arrow format string of a column type
+  static const char* arrowFormat( Parameter::Type type )
+  {
+    switch( type )
+    {
+      case Parameter::Int :
+        return "l";
+      case Parameter::Double :
+        return "g";
+      case Parameter::Bool :
+        return "b";
+      case Parameter::Text :
+        return "U";
+      case Parameter::Blob :
+        return "Z";
+    }
+    return "n";
+  }
+
+
+  void ColumnBatch::exportArrow( ArrowArray* array, ArrowSchema* schema )
+  {
+    const size_t count = _columns.size();
+
+    // Schema
+    SchemaData* schema_data = new SchemaData();
+    schema_data->children.resize( count );
+    for ( size_t i = 0; i < count; ++i )
+    {
+      schema_data->names.push_back( _columns[i].name );
+    }
+    for ( size_t i = 0; i < count; ++i )
+    {
+      ArrowSchema& child = schema_data->children[i];
+      child.format = arrowFormat( _columns[i].type );
+      child.name = schema_data->names[i].c_str();
+      child.metadata = nullptr;
+      child.flags = ARROW_FLAG_NULLABLE;
+      child.n_children = 0;
+      child.children = nullptr;
+      child.dictionary = nullptr;
+      child.release = releaseChildSchema;
+      child.private_data = nullptr;
+      schema_data->pointers.push_back( &child );
+    }
+
+    schema->format = "+s";
+    schema->name = "";
+    schema->metadata = nullptr;
+    schema->flags = 0;
+    schema->n_children = count;
+    schema->children = schema_data->pointers.data();
+    schema->dictionary = nullptr;
+    schema->release = releaseSchema;
+    schema->private_data = schema_data;
+
+    // Array. The buffers are moved, so their addresses don't change
+    ArrayData* array_data = new ArrayData();
+    array_data->columns.swap( _columns );
+    array_data->buffers.resize( count );
+    array_data->children.resize( count );
+    array_data->buffer = nullptr;
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+      const Column& column = array_data->columns[i];
+      std::vector< const void* >& buffers = array_data->buffers[i];
+
+      // A validity bitmap isn't needed without nulls
+      buffers.push_back( column.nullCount > 0 ? column.validity.data() : nullptr );
+
+      switch( column.type )
+      {
+        case Parameter::Int :
+          buffers.push_back( column.ints.data() );
+          break;
+
+        case Parameter::Double :
+          buffers.push_back( column.doubles.data() );
+          break;
+
+        case Parameter::Bool :
+          buffers.push_back( column.bits.data() );
+          break;
+
+        case Parameter::Text :
+        case Parameter::Blob :
+          buffers.push_back( column.offsets.data() );
+          buffers.push_back( column.data.data() );
+          break;
+      }
+
+      ArrowArray& child = array_data->children[i];
+      child.length = _rows;
+      child.null_count = column.nullCount;
+      child.offset = 0;
+      child.n_buffers = buffers.size();
+      child.n_children = 0;
+      child.buffers = buffers.data();
+      child.children = nullptr;
+      child.dictionary = nullptr;
+      child.release = releaseChildArray;
+      child.private_data = nullptr;
+      array_data->pointers.push_back( &child );
+    }
+
+    array->length = _rows;
+    array->null_count = 0;
+    array->offset = 0;
+    array->n_buffers = 1;
+    array->n_children = count;
+    array->buffers = &array_data->buffer;
+    array->children = array_data->pointers.data();
+    array->dictionary = nullptr;
+    array->release = releaseArray;
+    array->private_data = array_data;
+
+    // Leave the batch empty but usable
+    _columns.resize( count );
+    for ( size_t i = 0; i < count; ++i )
+    {
+      _columns[i].name = array_data->columns[i].name;
+      _columns[i].type = array_data->columns[i].type;
+    }
+    this->clear();
+  }
+
+}
+
@@ -3,8 +3,19 @@
 
 #include "Database.h"
 #include "Query.h"
+#include "QueryPool.h"
+#include "WriteQueue.h"
+#include "ThreadPool.h"
+#include "ResultCache.h"
+#include "ResponseEncoder.h"
+#include "QueryRegistry.h"
+#include "ResponseArena.h"
 
 #include <iostream>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <limits>
 #include <sys/stat.h>
 
 
@@ -12,20 +23,69 @@ namespace SQLW
 {
 
   Database::Database( const CON::Object& config ) :
-    _filename(),
-    _busyRetries( 10 ),
+    Database( config, config["database_file"].asString() )
+  {
+  }
+
+
+  Database::Database( const CON::Object& config, const std::string& filename ) :
+    _filename( filename ),
+    _immutable( false ),
+    _busyPolicy(),
+    _performance(),
     _connection(),
-    _queries()
+    _readers(),
+    _nextReader( 0 ),
+    _registry( nullptr ),
+    _epoch( 0 ),
+    _pins(),
+    _reloadMutex(),
+    _nextVersion( 1 ),
+    _workers( nullptr )
   {
     _connection.database = nullptr;
+    _connection.caches = nullptr;
+    _connection.busy = &_busyPolicy;
     // Use the schema to validate the config data
 
     // Load the config data
-    _filename = config["database_file"].asString();
+    _busyPolicy.configure( config );
+
+    size_t read_connections = 0;
+    if ( config.has( "read_connections" ) )
+    {
+      read_connections = config["read_connections"].asInt();
+    }
+
+    size_t worker_threads = 0;
+    if ( config.has( "worker_threads" ) )
+    {
+      worker_threads = config["worker_threads"].asInt();
+    }
+
+    if ( config.has( "immutable" ) )
+    {
+      _immutable = ( config["immutable"].asInt() != 0 );
+    }
+
+    if ( config.has( "performance" ) )
+    {
+      _performance.configure( config["performance"] );
+    }
 
-    if ( config.has( "busy_retries" ) )
+    // Readers only run in parallel with the writer in WAL mode. There is no writer if it's immutable
+    if ( read_connections > 0 && ! _immutable )
     {
-      _busyRetries = config["busy_retries"].asInt();
+      std::string mode = _performance.journalMode();
+      if ( mode.empty() )
+      {
+        _performance.setJournalMode( "wal" );
+      }
+      else if ( sqlite3_stricmp( mode.c_str(), "wal" ) != 0 )
+      {
+        std::cerr << "SQLW Error - read_connections require WAL mode. Requested journal_mode: " << mode << std::endl;
+        throw std::runtime_error( "Failed to enable WAL mode" );
+      }
     }
 
 
@@ -41,213 +101,1673 @@ namespace SQLW
       throw std::runtime_error( "Database Not Found" );
     }
 
-    result = sqlite3_open_v2( _filename.c_str(), &_connection.database, SQLITE_OPEN_READWRITE, nullptr );
-
-    if ( result != SQLITE_OK )
+    // Nothing changes the file, so map all of it unless told otherwise
+    if ( _immutable && _performance.get( "mmap_size" ).empty() )
     {
-      sqlite3_close( _connection.database );
-      _connection.database = nullptr;
-
-      throw std::runtime_error( "Database Error" );
+      _performance.setMmapSize( file_stat.st_size );
     }
 
-    // Load the query interfaces
-    const CON::Object& query_data = config["query_data"];
+    openConnection( _connection, SQLITE_OPEN_READWRITE );
 
-    for ( size_t i = 0; i < query_data.getSize(); ++i )
+    try
     {
-      const CON::Object query_conf = query_data[i];
+      for ( size_t i = 0; i < read_connections; ++i )
+      {
+        Connection* reader = new Connection();
+        reader->database = nullptr;
+        reader->caches = nullptr;
+        reader->busy = &_busyPolicy;
+        _readers.push_back( reader );
 
-      Query* q = new Query( _connection, query_conf );
+        openConnection( *reader, SQLITE_OPEN_READONLY );
+      }
+
+      // Load the query interfaces
+      this->publish( this->loadQueries( config ) );
 
-      _queries.insert( std::make_pair( query_conf["name"].asString(), q ) );
+      if ( worker_threads > 0 )
+      {
+        _workers = new ThreadPool( worker_threads );
+      }
+    }
+    catch ( ... )
+    {
+      // The destructor won't run, so release everything we've opened so far
+      this->close();
+      throw;
     }
   }
 
 
   Database::~Database()
   {
-    for ( QueryMap::iterator it = _queries.begin(); it != _queries.end(); ++it )
+    this->close();
+  }
+
+
+  void Database::close()
+  {
+    // Finish any asynchronous requests and commit anything still queued before the queries go
+    delete _workers;
+    _workers = nullptr;
+
+    delete _registry.exchange( nullptr );
+
+    for ( std::vector< Connection* >::iterator it = _readers.begin(); it != _readers.end(); ++it )
     {
-      delete it->second;
+      sqlite3_close_v2( (*it)->database );
+      delete (*it);
+    }
+    _readers.clear();
+
+    if ( _connection.caches != nullptr )
+    {
+      sqlite3_update_hook( _connection.database, nullptr, nullptr );
+      _connection.caches = nullptr;
     }
-    _queries.clear();
 
     sqlite3_close_v2( _connection.database );
+    _connection.database = nullptr;
   }
 
 
-  Query& Database::requestQuery( const char* name )
+  QueryRegistry* Database::loadQueries( const CON::Object& config )
   {
-    QueryMap::iterator found = _queries.find( name );
+    bool metrics = false;
+    if ( config.has( "metrics" ) )
+    {
+      metrics = ( config["metrics"].asInt() != 0 );
+    }
 
-    if ( found == _queries.end() )
+    // Statements are prepared as they are loaded, on first use, or by a thread per connection once loaded
+    bool lazy = false;
+    bool parallel = false;
+    if ( config.has( "prepare" ) )
     {
-      std::cerr << "SQLW Error - Requested query not found: " << name << std::endl;
-      throw std::runtime_error( "Requested query does not exist" );
+      std::string mode = config["prepare"].asString();
+      if ( mode == "lazy" )
+        lazy = true;
+      else if ( mode == "parallel" )
+        lazy = parallel = true;
+      else if ( mode != "eager" )
+      {
+        std::cerr << "SQLW Error - Unknown prepare mode: " << mode << ". Expected eager, lazy or parallel" << std::endl;
+        throw std::runtime_error( "Unknown prepare mode." );
+      }
     }
 
-    return *found->second;
-  }
+    bool validate = false;
+    if ( config.has( "validate" ) )
+    {
+      validate = ( config["validate"].asInt() != 0 );
+    }
+
+    if ( _immutable && config.has( "write_queue" ) )
+    {
+      std::cerr << "SQLW Error - An immutable database can not have a write queue: " << _filename << std::endl;
+      throw std::runtime_error( "Write queue configured for an immutable database." );
+    }
 
+    const CON::Object& query_data = config["query_data"];
 
-  bool Database::queryExists( const char* name ) const
-  {
-    if ( _queries.find( name ) == _queries.end() )
-      return false;
-    else
-      return true;
-  }
+    // Check all the SQL up front, so lazily prepared queries can't fail later
+    if ( validate )
+    {
+      std::vector< std::string > errors;
+      {
+        std::lock_guard< std::mutex > lock( _connection.mutex );
+        errors = validateQueries( _connection.database, query_data );
+      }
 
+      if ( ! errors.empty() )
+      {
+        for ( std::vector< std::string >::iterator it = errors.begin(); it != errors.end(); ++it )
+        {
+          std::cerr << "SQLW Error - " << *it << std::endl;
+        }
+        throw std::runtime_error( "Query validation failed." );
+      }
+    }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////
-  // Optional Friend functions
+    // Deleted if anything fails before it is published
+    std::unique_ptr< QueryRegistry > registry( new QueryRegistry( _nextVersion++ ) );
 
-////////////////////////////////////////////////////////////////////////////////
-  // RapidJson Library
+    // The queries on each connection, to prepare in parallel. The writer is first
+    std::vector< std::vector< Query* > > unprepared( 1 + _readers.size() );
+
+    for ( size_t i = 0; i < query_data.getSize(); ++i )
+    {
+      const CON::Object query_conf = query_data[i];
+
+      QueryPool* pool = new QueryPool( query_conf["name"].asString() );
+      if ( ! registry->add( pool ) )
+      {
+        std::cerr << "SQLW Error - Duplicate query name: " << pool->name() << std::endl;
+        delete pool;
+        throw std::runtime_error( "Duplicate query name." );
+      }
+
+      // Nothing writes to an immutable database, so every connection runs every query
+      if ( _immutable )
+      {
+        Query* primary = new Query( _connection, query_conf, lazy );
+        pool->add( primary );
+
+        primary->ensurePrepared();
+        if ( ! primary->readOnly() )
+        {
+          std::cerr << "SQLW Error - Only read-only queries can run on an immutable database: " << pool->name() << std::endl;
+          throw std::runtime_error( "Query writes to an immutable database." );
+        }
+
+        for ( size_t r = 0; r < _readers.size(); ++r )
+        {
+          Query* query = new Query( *_readers[r], query_conf, lazy );
+          pool->add( query );
+          unprepared[ 1 + r ].push_back( query );
+        }
+      }
+      // Read-only queries get a copy on every reader so they can run in parallel.
+      // Start on a different reader each time so the primary copies are spread out.
+      else if ( ! _readers.empty() && routesToReaders( query_conf ) )
+      {
+        for ( size_t r = 0; r < _readers.size(); ++r )
+        {
+          size_t reader = ( _nextReader + r ) % _readers.size();
+          Query* query = new Query( *_readers[ reader ], query_conf, lazy );
+          pool->add( query );
+          unprepared[ 1 + reader ].push_back( query );
+        }
+        _nextReader = ( _nextReader + 1 ) % _readers.size();
+      }
+      else
+      {
+        Query* query = new Query( _connection, query_conf, lazy );
+        pool->add( query );
+        unprepared[ 0 ].push_back( query );
+      }
+
+      if ( query_conf.has( "keyset" ) )
+      {
+        pool->enableKeyset( query_conf["keyset"] );
+      }
+
+      if ( query_conf.has( "cache_size" ) )
+      {
+        this->enableCache( *registry, *pool, query_conf["cache_size"].asInt() );
+      }
 
-  bool setParameter( Parameter& param, const rapidjson::Document& data )
+      if ( metrics )
+      {
+        pool->enableMetrics();
+      }
+    }
+
+    if ( parallel )
+    {
+      prepareParallel( unprepared );
+    }
+
+    if ( config.has( "write_queue" ) )
+    {
+      WriteQueue* queue = new WriteQueue( _connection, query_data, config["write_queue"] );
+      registry->setWriteQueue( queue );
+
+      // Queued writes are counted with the rest of the query's executions
+      const QueryRegistry::QueryMap& queries = registry->queries();
+      for ( QueryRegistry::QueryMap::const_iterator it = queries.begin(); metrics && it != queries.end(); ++it )
+      {
+        queue->setMetrics( it->first, it->second->enableMetrics() );
+      }
+    }
+
+    return registry.release();
+  }
+
+
+  QueryRegistry* Database::publish( QueryRegistry* registry )
   {
-    if ( ! data.HasMember( param.name().c_str() ) )
-      return false;
+    // Writes are only detected on the writer. Swapping with it locked means no write is half recorded
+    std::lock_guard< std::mutex > lock( _connection.mutex );
 
-    switch( param.type() )
+    CacheIndex* caches = registry->caches();
+
+    // Tables written inside a transaction that is still open are invalidated in the new caches when it ends
+    if ( caches != nullptr && _connection.caches != nullptr )
     {
-      case Parameter::Text :
-        if ( ! data[param.name().c_str()].IsString() )
-          return false;
-        else
-          param.set( std::string( data[param.name().c_str()].GetString() ) );
-        break;
-    
-      case Parameter::Int :
-        if ( ! data[param.name().c_str()].IsInt64() )
-          return false;
-        else
-          param.set( data[param.name().c_str()].GetInt64() );
-        break;
-    
-      case Parameter::Bool :
-        if ( ! data[param.name().c_str()].IsBool() )
-          return false;
-        else
-          param.set( data[param.name().c_str()].GetBool() );
-        break;
-    
-      case Parameter::Blob :
-        if ( ! data[param.name().c_str()].IsString() )
-          return false;
-        else
-          param.set( std::string( data[param.name().c_str()].GetString() ) );
-        break;
-    
-      case Parameter::Double :
-        if ( ! data[param.name().c_str()].IsDouble() )
-          return false;
-        else
-          param.set( data[param.name().c_str()].GetDouble() );
-        break;
+      caches->adopt( *_connection.caches );
     }
-    return true;
+
+    _connection.caches = caches;
+    if ( caches != nullptr )
+      sqlite3_update_hook( _connection.database, CacheIndex::updateHook, caches );
+    else
+      sqlite3_update_hook( _connection.database, nullptr, nullptr );
+
+    return _registry.exchange( registry );
   }
 
 
-  void getParameter( Parameter& param, rapidjson::Value& data, rapidjson::Document::AllocatorType& alloc )
+  void Database::synchronize()
   {
-    switch( param.type() )
+    // Flipping the epoch sends new pins to the other counter, so the old one drains. Pins that read the epoch
+    // just before a flip can still land in the counter being waited for, so both are drained in turn.
+    for ( int i = 0; i < 2; ++i )
     {
-      case Parameter::Text :
-        data.AddMember( rapidjson::Value( param.name().c_str(), alloc ).Move(),
-                        rapidjson::Value( static_cast<std::string>( param ).c_str(), alloc ), alloc );
-        break;
-    
-      case Parameter::Int :
-        data.AddMember( rapidjson::Value( param.name().c_str(), alloc ).Move(),
-                        static_cast< int64_t >( param ), alloc );
-        break;
-    
-      case Parameter::Bool :
-        data.AddMember( rapidjson::Value( param.name().c_str(), alloc ).Move(),
-                        static_cast< bool >( param ), alloc );
-        break;
-    
-      case Parameter::Blob :
-        data.AddMember( rapidjson::Value( param.name().c_str(), alloc ).Move(),
-                        rapidjson::Value( static_cast< std::string >( param ).c_str(), alloc ), alloc );
-        break;
-    
-      case Parameter::Double :
-        data.AddMember( rapidjson::Value( param.name().c_str(), alloc ).Move(),
-                        static_cast< double >( param ), alloc );
-        break;
+      size_t slot = _epoch.fetch_add( 1 ) & 1;
+      while ( _pins[ slot ].load() != 0 )
+      {
+        std::this_thread::sleep_for( std::chrono::microseconds( 50 ) );
+      }
     }
   }
 
 
-  rapidjson::Document executeJson( Database& db, const char* name, const rapidjson::Document& data )
+  void Database::reload( const CON::Object& config )
   {
-    Database::QueryMap::iterator found = db._queries.find( name );
-    rapidjson::Document response( rapidjson::kObjectType );
-    rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+    std::lock_guard< std::mutex > reload_lock( _reloadMutex );
+
+    // Everything is created and prepared before it can be seen. Requests carry on with the current queries meanwhile
+    QueryRegistry* registry = this->loadQueries( config );
+
+    QueryRegistry* old = this->publish( registry );
+
+    // Anything that found a query in the old registry is still pinning it
+    this->synchronize();
+    delete old;
+  }
+
+
+  Database::Pin::Pin( const Database& database ) :
+    _database( database ),
+    _slot( database._epoch.load() & 1 ),
+    _registry( nullptr )
+  {
+    // Counted before the registry is read, so a reload that swaps it afterwards waits for this pin
+    _database._pins[ _slot ].fetch_add( 1 );
+    _registry = _database._registry.load();
+  }
+
+
+  Database::Pin::~Pin()
+  {
+    _database._pins[ _slot ].fetch_sub( 1 );
+  }
+
+
+  QueryPool* Database::Pin::find( const char* name ) const
+  {
+    return _registry->find( name );
+  }
+
+
+  QueryPool* Database::Pin::find( const QueryHandle& handle ) const
+  {
+    if ( handle._pool == nullptr || handle._version == _registry->version() )
+      return handle._pool;
+    else
+      return _registry->find( handle._name );
+  }
+
+
+  void Database::enableCache( QueryRegistry& registry, QueryPool& pool, size_t capacity )
+  {
+    Query& query = pool.primary();
 
-    if ( found == db._queries.end() )
+    // The tables it reads are only known once it is prepared
+    query.ensurePrepared();
+
+    // Only a read can be answered from a cache
+    if ( ! query.readOnly() )
     {
-      response.AddMember( "success", false, alloc );
-      response.AddMember( "error", rapidjson::Value( "Invalid request. Does not exist.", alloc ), alloc );
-      response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
-      return response;
+      std::cerr << "SQLW Error - Only read-only queries can be cached: " << pool.name() << std::endl;
+      throw std::runtime_error( "Only read-only queries can be cached." );
     }
 
-    Query& query = *found->second;
+    if ( capacity == 0 )
+      return;
 
-    // Lock the query. We're using it now
-    auto query_lock = query.acquire();
+    // All writes go through the writer, so it is the only connection that needs watching.
+    // The index is installed on it when the registry is published
+    CacheIndex& caches = registry.watchCaches();
 
-    // Load the parameters
-    for ( Query::ParameterIterator pit = query.parametersBegin(); pit != query.parametersEnd(); ++pit )
-    {
-      if ( ! setParameter( *pit, data ) )
-      {
-        std::string err_string( "Invalid request parameter: " );
-        err_string += pit->name();
+    ResultCache* cache = pool.enableCache( capacity );
 
-        response.AddMember( "success", false, response.GetAllocator() );
-        response.AddMember( "error", rapidjson::Value( err_string.c_str(), alloc ), alloc );
-        response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
-        return response;
-      }
+    const std::vector< std::string >& tables = query.readTables();
+    for ( std::vector< std::string >::const_iterator it = tables.begin(); it != tables.end(); ++it )
+    {
+      caches.watch( *it, cache );
     }
+  }
 
-    rapidjson::Value column_data( rapidjson::kArrayType );
 
-    // Lock the database connection
-    query.prepare();
+  // Build a URI that opens the file read-only, without taking any locks or checking for changes
+  static std::string immutableUri( const std::string& filename )
+  {
+    static const char* const hex = "0123456789ABCDEF";
 
-    // Step through the query
-    while ( query.step() )
+    std::string uri( "file:" );
+    for ( std::string::const_iterator it = filename.begin(); it != filename.end(); ++it )
     {
-      rapidjson::Value col( rapidjson::kObjectType );
-      for ( Query::ColumnIterator cit = query.columnsBegin(); cit != query.columnsEnd(); ++cit )
+      // Characters that end or escape the path
+      if ( *it == '?' || *it == '#' || *it == '%' )
       {
-        getParameter( *cit, col, alloc );
+        uri.push_back( '%' );
+        uri.push_back( hex[ ( *it >> 4 ) & 0xf ] );
+        uri.push_back( hex[ *it & 0xf ] );
+      }
+      else
+      {
+        uri.push_back( *it );
       }
-      column_data.PushBack( col, alloc );
     }
+    uri += "?mode=ro&immutable=1";
 
-    // Release the database connection
-    query.reset();
+    return uri;
+  }
 
-    if ( query.error() )
+
+  void Database::openConnection( Connection& connection, int flags )
+  {
+    int result;
+    if ( _immutable )
     {
-      response.AddMember( "success", false, alloc );
-      response.AddMember( "error", rapidjson::Value( query.getError(), alloc ), alloc );
-      response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
+      // Each connection is only used while its mutex is held, so sqlite needn't lock it as well
+      flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_URI | SQLITE_OPEN_NOMUTEX;
+      result = sqlite3_open_v2( immutableUri( _filename ).c_str(), &connection.database, flags, nullptr );
     }
     else
     {
-      response.AddMember( "success", true, alloc );
-      response.AddMember( "data", column_data, alloc );
+      result = sqlite3_open_v2( _filename.c_str(), &connection.database, flags, nullptr );
+    }
+
+    if ( result != SQLITE_OK )
+    {
+      sqlite3_close( connection.database );
+      connection.database = nullptr;
+
+      throw std::runtime_error( "Database Error" );
+    }
+
+    try
+    {
+      _performance.apply( connection.database, ( flags & SQLITE_OPEN_READWRITE ) != 0 );
+    }
+    catch ( ... )
+    {
+      sqlite3_close( connection.database );
+      connection.database = nullptr;
+      throw;
     }
+  }
+
+
+  void Database::prepareParallel( const std::vector< std::vector< Query* > >& connections )
+  {
+    // A connection can only prepare one statement at a time, so each gets its own thread
+    std::vector< std::thread > threads;
+    std::vector< std::exception_ptr > errors( connections.size() );
+
+    for ( size_t i = 0; i < connections.size(); ++i )
+    {
+      if ( connections[i].empty() )
+        continue;
+
+      threads.push_back( std::thread( [&connections, &errors, i]()
+        {
+          try
+          {
+            for ( std::vector< Query* >::const_iterator it = connections[i].begin(); it != connections[i].end(); ++it )
+            {
+              (*it)->ensurePrepared();
+            }
+          }
+          catch ( ... )
+          {
+            errors[i] = std::current_exception();
+          }
+        } ) );
+    }
+
+    for ( std::vector< std::thread >::iterator it = threads.begin(); it != threads.end(); ++it )
+    {
+      it->join();
+    }
+
+    for ( std::vector< std::exception_ptr >::iterator it = errors.begin(); it != errors.end(); ++it )
+    {
+      if ( *it )
+        std::rethrow_exception( *it );
+    }
+  }
+
+
+  std::vector< std::string > Database::validateQueries( sqlite3* database, const CON::Object& query_data )
+  {
+    std::vector< std::string > errors;
+
+    for ( size_t i = 0; i < query_data.getSize(); ++i )
+    {
+      const CON::Object query_conf = query_data[i];
+      const std::string name = query_conf["name"].asString();
+      const std::string statement_text = query_conf["statement"].asString();
+
+      // Compile and throw away each statement
+      sqlite3_stmt* statement = nullptr;
+      int result = sqlite3_prepare_v2( database, statement_text.c_str(), statement_text.size(), &statement, nullptr );
+
+      if ( result != SQLITE_OK || statement == nullptr )
+      {
+        errors.push_back( "Query " + name + " failed to prepare: " + sqlite3_errmsg( database ) );
+      }
+      else if ( (size_t)sqlite3_bind_parameter_count( statement ) != query_conf["parameters"].getSize() )
+      {
+        errors.push_back( "Query " + name + " has " + std::to_string( sqlite3_bind_parameter_count( statement ) ) +
+                          " parameters. Configured with " + std::to_string( query_conf["parameters"].getSize() ) );
+      }
+      else if ( (size_t)sqlite3_column_count( statement ) < query_conf["columns"].getSize() )
+      {
+        errors.push_back( "Query " + name + " returns " + std::to_string( sqlite3_column_count( statement ) ) +
+                          " columns. Configured with " + std::to_string( query_conf["columns"].getSize() ) );
+      }
+      else if ( query_conf.has( "read_only" ) && query_conf["read_only"].asInt() != 0 && ! sqlite3_stmt_readonly( statement ) )
+      {
+        errors.push_back( "Query " + name + " is declared read_only but writes to the database" );
+      }
+
+      sqlite3_finalize( statement );
+    }
+
+    return errors;
+  }
+
+
+  std::vector< std::string > Database::validate( const CON::Object& config )
+  {
+    std::vector< std::string > errors;
+
+    sqlite3* database = nullptr;
+    std::string filename = config["database_file"].asString();
+    if ( sqlite3_open_v2( filename.c_str(), &database, SQLITE_OPEN_READONLY, nullptr ) != SQLITE_OK )
+    {
+      errors.push_back( "Failed to open " + filename + ": " + sqlite3_errmsg( database ) );
+    }
+    else
+    {
+      errors = validateQueries( database, config["query_data"] );
+    }
+
+    sqlite3_close( database );
+    return errors;
+  }
+
+
+  PerformanceProfile::Settings Database::performance()
+  {
+    std::lock_guard< std::mutex > lock( _connection.mutex );
+    return PerformanceProfile::effective( _connection.database );
+  }
+
+
+  bool Database::isReadOnly( const std::string& statement_text )
+  {
+    // Prepare a throw-away copy to ask sqlite if the statement writes to the database.
+    // Any errors are left for the query to report.
+    std::lock_guard< std::mutex > lock( _connection.mutex );
+    sqlite3_stmt* statement = nullptr;
+    int result = sqlite3_prepare_v2( _connection.database, statement_text.c_str(), statement_text.size(), &statement, nullptr );
+    bool read_only = ( result == SQLITE_OK && statement != nullptr && sqlite3_stmt_readonly( statement ) );
+    sqlite3_finalize( statement );
+
+    return read_only;
+  }
+
+
+  bool Database::routesToReaders( const CON::Object& query_conf )
+  {
+    // Saves compiling every statement on the writer, one at a time, before the real copies are prepared
+    if ( query_conf.has( "read_only" ) )
+    {
+      return query_conf["read_only"].asInt() != 0;
+    }
+
+    return this->isReadOnly( query_conf["statement"].asString() );
+  }
+
+
+  Query& Database::requestQuery( const char* name )
+  {
+    return this->requestPool( name ).primary();
+  }
+
+
+  QueryPool& Database::requestPool( const char* name )
+  {
+    Pin pin( *this );
+    QueryPool* found = pin.find( name );
+
+    if ( found == nullptr )
+    {
+      std::cerr << "SQLW Error - Requested query not found: " << name << std::endl;
+      throw std::runtime_error( "Requested query does not exist" );
+    }
+
+    return *found;
+  }
+
+
+  QueryHandle Database::resolve( const char* name ) const
+  {
+    Pin pin( *this );
+    QueryPool* found = pin.find( name );
+
+    if ( found == nullptr )
+      return QueryHandle();
+    else
+      return QueryHandle( found, pin.registry().version(), name );
+  }
+
+
+  bool Database::queryExists( const char* name ) const
+  {
+    Pin pin( *this );
+    if ( pin.find( name ) == nullptr )
+      return false;
+    else
+      return true;
+  }
+
+
+  bool transaction( Connection& connection, const char* statement )
+  {
+    // The caller is holding the connection for the transaction, so keep it while waiting
+    int result;
+    unsigned attempt = 0;
+    while ( result = sqlite3_exec( connection.database, statement, nullptr, nullptr, nullptr ), result == SQLITE_BUSY )
+    {
+      if ( ! connection.busy->wait( attempt++ ) )
+      {
+        break;
+      }
+    }
+
+    if ( connection.caches != nullptr )
+      connection.caches->flush( connection.database );
+
+    return result == SQLITE_OK;
+  }
+
+
+  std::vector< QueryStatistics > Database::statistics() const
+  {
+    Pin pin( *this );
+    const QueryRegistry::QueryMap& queries = pin.registry().queries();
+
+    std::vector< QueryStatistics > stats;
+    for ( QueryRegistry::QueryMap::const_iterator it = queries.begin(); it != queries.end(); ++it )
+    {
+      if ( it->second->metrics() != nullptr )
+      {
+        stats.push_back( it->second->metrics()->snapshot( it->first ) );
+      }
+    }
+
+    std::sort( stats.begin(), stats.end(), []( const QueryStatistics& a, const QueryStatistics& b ) { return a.name < b.name; } );
+    return stats;
+  }
+
+
+  void Database::invalidateCaches()
+  {
+    Pin pin( *this );
+    if ( pin.registry().caches() != nullptr )
+      pin.registry().caches()->invalidateAll();
+  }
+
+
+  BlobStream Database::openBlob( const char* table, const char* column, int64_t row, bool writable )
+  {
+    if ( writable || _readers.empty() )
+    {
+      return BlobStream( _connection, std::unique_lock< std::mutex >( _connection.mutex ), table, column, row, writable );
+    }
+
+    // Take whichever reader is free, or wait for the first
+    for ( std::vector< Connection* >::iterator it = _readers.begin(); it != _readers.end(); ++it )
+    {
+      std::unique_lock< std::mutex > lock( (*it)->mutex, std::try_to_lock );
+      if ( lock.owns_lock() )
+      {
+        return BlobStream( **it, std::move( lock ), table, column, row, false );
+      }
+    }
+
+    Connection& reader = *_readers.front();
+    return BlobStream( reader, std::unique_lock< std::mutex >( reader.mutex ), table, column, row, false );
+  }
+
+
+  std::future< Status > Database::enqueue( const char* name, std::function< bool( Query& ) > loader )
+  {
+    Pin pin( *this );
+    return this->enqueue( pin, name, std::move( loader ) );
+  }
+
+
+  std::future< Status > Database::enqueue( const Pin& pin, const char* name, std::function< bool( Query& ) > loader )
+  {
+    WriteQueue* queue = pin.registry().writeQueue();
+    if ( queue == nullptr )
+    {
+      std::cerr << "SQLW Error - Write queue is not enabled for: " << _filename << std::endl;
+      throw std::runtime_error( "Write queue is not enabled" );
+    }
+
+    return queue->push( name, std::move( loader ) );
+  }
+
+
+  bool Database::hasWriteQueue() const
+  {
+    Pin pin( *this );
+    return pin.registry().writeQueue() != nullptr;
+  }
+
+
+  std::future< void > Database::executeAsync( const char* name, std::function< void( Query& ) > task )
+  {
+    // Checked now so an unknown name throws here rather than on the worker
+    this->requestPool( name );
+    std::string query_name( name );
+
+    // Packaged tasks are move-only, so share it with the job.
+    // The query is found again when the job runs, as it may have been reloaded in between
+    std::shared_ptr< std::packaged_task< void() > > job = std::make_shared< std::packaged_task< void() > >( [this, query_name, task]()
+      {
+        Pin pin( *this );
+        QueryPool* pool = pin.find( query_name.c_str() );
+        if ( pool == nullptr )
+        {
+          std::cerr << "SQLW Error - Requested query not found: " << query_name << std::endl;
+          throw std::runtime_error( "Requested query does not exist" );
+        }
+
+        Query::LockType lock = pool->checkout();
+        task( *lock.mutex() );
+      } );
+
+    std::future< void > result = job->get_future();
+    this->submit( [job]() { (*job)(); } );
+
+    return result;
+  }
+
+
+  void Database::submit( std::function< void() > job )
+  {
+    if ( _workers == nullptr )
+    {
+      std::cerr << "SQLW Error - Worker threads are not enabled for: " << _filename << std::endl;
+      throw std::runtime_error( "Worker threads are not enabled" );
+    }
+
+    _workers->submit( std::move( job ) );
+  }
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+  // Optional Friend functions
+
+////////////////////////////////////////////////////////////////////////////////
+  // RapidJson Library
+
+  // Load a parameter from a json value. Text and blobs are copied, or viewed in place if copy is false.
+  // Returns false if the value is the wrong type
+  static bool loadValue( Parameter& param, const rapidjson::Value& value, bool copy )
+  {
+    switch( param.type() )
+    {
+      case Parameter::Text :
+      case Parameter::Blob :
+        if ( ! value.IsString() )
+          return false;
+        else if ( copy )
+          param.assign( std::string_view( value.GetString(), value.GetStringLength() ) );
+        else
+          param.bindView( std::string_view( value.GetString(), value.GetStringLength() ) );
+        break;
+    
+      case Parameter::Int :
+        if ( ! value.IsInt64() )
+          return false;
+        else
+          param.set( value.GetInt64() );
+        break;
+    
+      case Parameter::Bool :
+        if ( ! value.IsBool() )
+          return false;
+        else
+          param.set( value.GetBool() );
+        break;
+    
+      case Parameter::Double :
+        if ( ! value.IsDouble() )
+          return false;
+        else
+          param.set( value.GetDouble() );
+        break;
+    }
+    return true;
+  }
+
+
+  bool setParameter( Parameter& param, const rapidjson::Value& data )
+  {
+    rapidjson::Value::ConstMemberIterator found = data.FindMember( param.name().c_str() );
+    if ( found == data.MemberEnd() )
+      return false;
+
+    return loadValue( param, found->value, true );
+  }
+
+
+  // Load the parameters from the members of an object. Parameters already marked as loaded may be missing.
+  // Returns the first parameter that is missing or the wrong type, or null if they were all set
+  static const Parameter* bindMembers( const BindingPlan& plan, Query& query, const rapidjson::Value& data, std::vector< bool >& loaded )
+  {
+    size_t count = std::count( loaded.begin(), loaded.end(), true );
+
+    if ( ! data.IsObject() )
+    {
+      for ( size_t n = 0; n < plan.size(); ++n )
+      {
+        if ( ! loaded[n] )
+          return &query.getParameter( n );
+      }
+      return nullptr;
+    }
+
+    // Each member is looked up once. Members that aren't parameters are ignored
+
+    for ( rapidjson::Value::ConstMemberIterator it = data.MemberBegin(); it != data.MemberEnd(); ++it )
+    {
+      std::string_view name( it->name.GetString(), it->name.GetStringLength() );
+      for ( size_t n = plan.find( name ); n != BindingPlan::npos; n = plan.next( n ) )
+      {
+        if ( ! loadValue( query.getParameter( n ), it->value, false ) )
+          return &query.getParameter( n );
+
+        if ( ! loaded[n] )
+        {
+          loaded[n] = true;
+          count += 1;
+        }
+      }
+    }
+
+    if ( count == plan.size() )
+      return nullptr;
+
+    // Report the first one that's missing
+    for ( size_t n = 0; n < plan.size(); ++n )
+    {
+      if ( ! loaded[n] )
+        return &query.getParameter( n );
+    }
+    return nullptr;
+  }
+
+
+  // Flags for bindMembers, kept by each thread so binding a request doesn't allocate
+  static std::vector< bool >& loadedFlags( size_t size )
+  {
+    static thread_local std::vector< bool > loaded;
+    loaded.assign( size, false );
+    return loaded;
+  }
+
+
+  const Parameter* bindJson( const BindingPlan& plan, Query& query, const rapidjson::Value& data )
+  {
+    return bindMembers( plan, query, data, loadedFlags( plan.size() ) );
+  }
+
+
+  const char* bindRequest( const QueryPool& pool, Query& query, const rapidjson::Value& data )
+  {
+    const KeysetPlan& keyset = pool.keyset();
+
+    // A continuation token from the previous page stands in for the key parameters
+    const rapidjson::Value* cursor = nullptr;
+    if ( keyset.enabled() && data.IsObject() )
+    {
+      rapidjson::Value::ConstMemberIterator found = data.FindMember( "cursor" );
+      if ( found != data.MemberEnd() )
+        cursor = &found->value;
+    }
+
+    std::vector< bool >& loaded = loadedFlags( pool.plan().size() );
+    for ( size_t k = 0; cursor != nullptr && k < keyset.size(); ++k )
+    {
+      loaded[ keyset.parameter( k ) ] = true;
+    }
+
+    const Parameter* invalid = bindMembers( pool.plan(), query, data, loaded );
+    if ( invalid != nullptr )
+      return invalid->name().c_str();
+
+    // Decoded last, so the token wins over any key parameters sent with it
+    if ( cursor != nullptr &&
+         ( ! cursor->IsString() || ! keyset.decode( std::string_view( cursor->GetString(), cursor->GetStringLength() ), query ) ) )
+      return "cursor";
+
+    return nullptr;
+  }
+
+
+  bool loadPageKeys( const KeysetPlan& keyset, Query& query, const rapidjson::Value& rows )
+  {
+    if ( ! keyset.more( query, rows.Size() ) )
+      return false;
+
+    const rapidjson::Value& last = rows[ rows.Size() - 1 ];
+    for ( size_t k = 0; k < keyset.size(); ++k )
+    {
+      if ( ! setParameter( query.getColumn( keyset.column( k ) ), last ) )
+        return false;
+    }
+    return true;
+  }
+
+
+  // Add the token for the page after the one whose last keys are in the query's columns
+  static void addNextPage( const KeysetPlan& keyset, const Query& query, rapidjson::Document& response )
+  {
+    std::string token = keyset.encode( query );
+
+    rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+    response.AddMember( "next", rapidjson::Value( token.c_str(), static_cast< rapidjson::SizeType >( token.size() ), alloc ), alloc );
+  }
+
+
+  void getParameter( Parameter& param, rapidjson::Value& data, rapidjson::Document::AllocatorType& alloc )
+  {
+    switch( param.type() )
+    {
+      case Parameter::Text :
+        {
+          std::string_view value = param.view();
+          data.AddMember( rapidjson::Value( param.name().c_str(), alloc ).Move(),
+                          rapidjson::Value( value.data(), static_cast< rapidjson::SizeType >( value.size() ), alloc ), alloc );
+        }
+        break;
+    
+      case Parameter::Int :
+        data.AddMember( rapidjson::Value( param.name().c_str(), alloc ).Move(),
+                        static_cast< int64_t >( param ), alloc );
+        break;
+    
+      case Parameter::Bool :
+        data.AddMember( rapidjson::Value( param.name().c_str(), alloc ).Move(),
+                        static_cast< bool >( param ), alloc );
+        break;
+    
+      case Parameter::Blob :
+        {
+          // Blobs may contain nulls, so copy by length
+          std::string_view value = param.view();
+          data.AddMember( rapidjson::Value( param.name().c_str(), alloc ).Move(),
+                          rapidjson::Value( value.data(), static_cast< rapidjson::SizeType >( value.size() ), alloc ), alloc );
+        }
+        break;
+    
+      case Parameter::Double :
+        data.AddMember( rapidjson::Value( param.name().c_str(), alloc ).Move(),
+                        static_cast< double >( param ), alloc );
+        break;
+    }
+  }
+
+
+  // Run a checked out query with its parameters loaded, and fill in the response.
+  // Paged queries add the token for the next page
+  static void executeBound( QueryPool& pool, Query& query, rapidjson::Document& response )
+  {
+    rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+    const KeysetPlan& keyset = pool.keyset();
+
+    // Answer from the cache if these parameters have been seen since the tables last changed
+    ResultCache* cache = pool.cache();
+    std::string cache_key;
+    uint64_t generation = 0;
+    if ( cache != nullptr )
+    {
+      cache_key = ResultCache::makeKey( query );
+      ResultCache::Entry entry = cache->find( cache_key, generation );
+      if ( entry )
+      {
+        response.AddMember( "success", true, alloc );
+        response.AddMember( "data", rapidjson::Value( *entry, alloc ), alloc );
+
+        // Cached pages aren't stepped, so the keys are read back from the last row
+        if ( keyset.enabled() && loadPageKeys( keyset, query, *entry ) )
+        {
+          addNextPage( keyset, query, response );
+        }
+        return;
+      }
+    }
+
+    rapidjson::Value column_data( rapidjson::kArrayType );
+
+    // True if the last row has a null key
+    bool null_key = false;
+
+    // Lock the database connection
+    query.prepare();
+
+    // Step through the query
+    while ( query.step() )
+    {
+      rapidjson::Value col( rapidjson::kObjectType );
+      for ( Query::ColumnIterator cit = query.columnsBegin(); cit != query.columnsEnd(); ++cit )
+      {
+        getParameter( *cit, col, alloc );
+      }
+      column_data.PushBack( col, alloc );
+
+      if ( keyset.enabled() )
+        null_key = ! keyset.record( query );
+    }
+
+    // Release the database connection
+    query.reset();
+
+    const bool next_page = keyset.enabled() && keyset.more( query, column_data.Size() );
+
+    if ( query.error() || ( next_page && null_key ) )
+    {
+      response.AddMember( "success", false, alloc );
+      response.AddMember( "error", rapidjson::Value( query.error() ? query.getError() : KeysetPlan::nullKeyError, alloc ), alloc );
+      response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
+    }
+    else
+    {
+      if ( cache != nullptr )
+      {
+        std::shared_ptr< rapidjson::Document > entry = std::make_shared< rapidjson::Document >();
+        entry->CopyFrom( column_data, entry->GetAllocator() );
+        cache->insert( cache_key, entry, generation );
+      }
+
+      response.AddMember( "success", true, alloc );
+      response.AddMember( "data", column_data, alloc );
+
+      if ( next_page )
+      {
+        addNextPage( keyset, query, response );
+      }
+    }
+  }
+
+
+  // Run a query the caller has pinned, filling in an empty response object. Null if it doesn't exist
+  static void executeJson( QueryPool* found, const rapidjson::Document& data, rapidjson::Document& response )
+  {
+    rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+
+    if ( found == nullptr )
+    {
+      response.AddMember( "success", false, alloc );
+      response.AddMember( "error", rapidjson::Value( "Invalid request. Does not exist.", alloc ), alloc );
+      response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
+      return;
+    }
+
+    QueryPool& pool = *found;
+
+    // Check out a free copy of the query. We're using it now
+    Query::LockType query_lock = pool.checkout();
+    Query& query = *query_lock.mutex();
+
+    // Load the parameters. The request outlives the execution, so strings are bound in place
+    const char* invalid = bindRequest( pool, query, data );
+    if ( invalid != nullptr )
+    {
+      std::string err_string( "Invalid request parameter: " );
+      err_string += invalid;
+
+      response.AddMember( "success", false, alloc );
+      response.AddMember( "error", rapidjson::Value( err_string.c_str(), alloc ), alloc );
+      response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
+      return;
+    }
+
+    executeBound( pool, query, response );
+  }
+
+
+  rapidjson::Document executeJson( Database& db, const char* name, const rapidjson::Document& data )
+  {
+    Database::Pin pin( db );
+    rapidjson::Document response( rapidjson::kObjectType );
+    executeJson( pin.find( name ), data, response );
+    return response;
+  }
+
+
+  rapidjson::Document executeJson( Database& db, const QueryHandle& handle, const rapidjson::Document& data )
+  {
+    Database::Pin pin( db );
+    rapidjson::Document response( rapidjson::kObjectType );
+    executeJson( pin.find( handle ), data, response );
+    return response;
+  }
+
+
+  rapidjson::Document& executeJson( Database& db, const char* name, const rapidjson::Document& data, ResponseArena& arena )
+  {
+    rapidjson::Document& response = arena.reset();
+    Database::Pin pin( db );
+    executeJson( pin.find( name ), data, response );
+    return response;
+  }
+
+
+  rapidjson::Document& executeJson( Database& db, const QueryHandle& handle, const rapidjson::Document& data, ResponseArena& arena )
+  {
+    rapidjson::Document& response = arena.reset();
+    Database::Pin pin( db );
+    executeJson( pin.find( handle ), data, response );
+    return response;
+  }
+
+
+  /*
+   * A rapidjson stream over a fixed length buffer, parsed in place.
+   * Decoded strings are written back over the buffer, so they can be bound without copying.
+   */
+  struct RawRequestStream
+  {
+    typedef char Ch;
+
+    // Next character to read, the start of the buffer, and one past its end
+    Ch* src_;
+    Ch* begin_;
+    Ch* end_;
+
+    // Where the next decoded string character is written
+    Ch* dst_;
+
+    RawRequestStream( Ch* buffer, size_t length ) : src_( buffer ), begin_( buffer ), end_( buffer + length ), dst_( nullptr ) {}
+
+    Ch Peek() const { return src_ == end_ ? '\0' : *src_; }
+    Ch Take() { return src_ == end_ ? '\0' : *src_++; }
+    size_t Tell() const { return static_cast< size_t >( src_ - begin_ ); }
+
+    Ch* PutBegin() { return dst_ = src_; }
+    void Put( Ch c ) { *dst_++ = c; }
+    void Flush() {}
+    size_t PutEnd( Ch* begin ) { return static_cast< size_t >( dst_ - begin ); }
+  };
+
+
+  /*
+   * SAX handler that binds the members of the request object to the query's parameters as they are parsed.
+   * Members that aren't parameters are skipped, along with anything nested inside them.
+   * A paged query's "cursor" is kept to decode once the parameters are set, and stands in for its keys.
+   */
+  class RawRequestBinder : public rapidjson::BaseReaderHandler< rapidjson::UTF8<>, RawRequestBinder >
+  {
+    private:
+      // Finds the parameters for each member
+      const BindingPlan& _plan;
+
+      // The query being loaded
+      Query& _query;
+
+      // The query's paging
+      const KeysetPlan& _keyset;
+
+      // Which parameters have been set, and how many
+      std::vector< bool > _loaded;
+      size_t _count;
+
+      // True while the current member is the cursor, and once one has been seen
+      bool _inCursor;
+      bool _hasCursor;
+
+      // The cursor's token. Empty if it wasn't a string
+      std::string_view _cursor;
+
+      // Holds the token if the parser couldn't decode it in place
+      std::string _cursorCopy;
+
+      // Nesting depth. Parameters are the members at depth 1
+      unsigned _depth;
+
+      // First parameter for the current member, or npos to skip it
+      size_t _current;
+
+      // The parameter that was given the wrong type
+      const Parameter* _invalid;
+
+
+      // Count a parameter as set
+      void mark( size_t n )
+      {
+        if ( ! _loaded[n] )
+        {
+          _loaded[n] = true;
+          _count += 1;
+        }
+      }
+
+      // Load the current member's parameters. The function returns false if the value is the wrong type
+      template < class FUNCTION >
+      bool load( FUNCTION&& function )
+      {
+        if ( _depth == 0 )
+          return false;
+
+        if ( _depth > 1 )
+          return true;
+
+        // The cursor stands in for the key parameters, whatever its value. A bad one fails when it's decoded
+        if ( _inCursor && ! _hasCursor )
+        {
+          _hasCursor = true;
+          for ( size_t k = 0; k < _keyset.size(); ++k )
+          {
+            this->mark( _keyset.parameter( k ) );
+          }
+        }
+
+        for ( size_t n = _current; n != BindingPlan::npos; n = _plan.next( n ) )
+        {
+          if ( ! function( _query.getParameter( n ) ) )
+          {
+            _invalid = &_query.getParameter( n );
+            return false;
+          }
+
+          this->mark( n );
+        }
+        return true;
+      }
+
+      // Refuse a value for the current member. Nested values can't be parameters
+      bool refuse()
+      {
+        return this->load( []( Parameter& ) { return false; } );
+      }
+
+
+    public:
+      RawRequestBinder( const BindingPlan& plan, const KeysetPlan& keyset, Query& query ) :
+        _plan( plan ),
+        _query( query ),
+        _keyset( keyset ),
+        _loaded( plan.size(), false ),
+        _count( 0 ),
+        _inCursor( false ),
+        _hasCursor( false ),
+        _cursor(),
+        _cursorCopy(),
+        _depth( 0 ),
+        _current( BindingPlan::npos ),
+        _invalid( nullptr )
+      {
+      }
+
+      // Return the parameter that was given the wrong type, if any
+      const Parameter* invalid() const { return _invalid; }
+
+      // Returns true if the request has a cursor
+      bool hasCursor() const { return _hasCursor; }
+
+      // The cursor's token. Points into the request buffer
+      std::string_view cursor() const { return _cursor; }
+
+      // Return the first parameter that wasn't in the request, or null if they were all set
+      const Parameter* missing() const
+      {
+        if ( _count == _plan.size() )
+          return nullptr;
+
+        for ( size_t n = 0; n < _plan.size(); ++n )
+        {
+          if ( ! _loaded[n] )
+            return &_query.getParameter( n );
+        }
+        return nullptr;
+      }
+
+
+      bool Null() { return this->refuse(); }
+
+      bool Bool( bool value )
+      {
+        return this->load( [value]( Parameter& param )
+          {
+            if ( param.type() != Parameter::Bool )
+              return false;
+            param.set( value );
+            return true;
+          } );
+      }
+
+      bool Int( int value ) { return this->Int64( value ); }
+      bool Uint( unsigned value ) { return this->Int64( value ); }
+
+      bool Int64( int64_t value )
+      {
+        return this->load( [value]( Parameter& param )
+          {
+            if ( param.type() != Parameter::Int )
+              return false;
+            param.set( value );
+            return true;
+          } );
+      }
+
+      bool Uint64( uint64_t value )
+      {
+        if ( value > static_cast< uint64_t >( std::numeric_limits< int64_t >::max() ) )
+          return this->refuse();
+        else
+          return this->Int64( static_cast< int64_t >( value ) );
+      }
+
+      bool Double( double value )
+      {
+        return this->load( [value]( Parameter& param )
+          {
+            if ( param.type() != Parameter::Double )
+              return false;
+            param.set( value );
+            return true;
+          } );
+      }
+
+      // Strings parsed in place point into the request buffer, so they are bound as views
+      bool String( const char* value, rapidjson::SizeType length, bool copy )
+      {
+        if ( _depth == 1 && _inCursor )
+        {
+          if ( copy )
+          {
+            _cursorCopy.assign( value, length );
+            _cursor = _cursorCopy;
+          }
+          else
+            _cursor = std::string_view( value, length );
+        }
+
+        return this->load( [value, length, copy]( Parameter& param )
+          {
+            if ( param.type() != Parameter::Text && param.type() != Parameter::Blob )
+              return false;
+            if ( copy )
+              param.set( std::string( value, length ) );
+            else
+              param.bindView( std::string_view( value, length ) );
+            return true;
+          } );
+      }
+
+      bool Key( const char* name, rapidjson::SizeType length, bool )
+      {
+        if ( _depth == 1 )
+        {
+          std::string_view key( name, length );
+          _current = _plan.find( key );
+          _inCursor = ( _keyset.enabled() && key == "cursor" );
+        }
+        return true;
+      }
+
+      bool StartObject()
+      {
+        if ( _depth != 0 && ! this->refuse() )
+          return false;
+
+        _depth += 1;
+        return true;
+      }
+
+      bool EndObject( rapidjson::SizeType )
+      {
+        _depth -= 1;
+        return true;
+      }
+
+      bool StartArray()
+      {
+        if ( ! this->refuse() )
+          return false;
+
+        _depth += 1;
+        return true;
+      }
+
+      bool EndArray( rapidjson::SizeType )
+      {
+        _depth -= 1;
+        return true;
+      }
+  };
+
+
+  // Encode the response of a query the caller has pinned. Null if it doesn't exist
+  static void executeEncoded( QueryPool* found, const rapidjson::Document& data, ResponseEncoder& encoder )
+  {
+    if ( found == nullptr )
+    {
+      encoder.fail( "Invalid request. Does not exist." );
+      return;
+    }
+
+    QueryPool& pool = *found;
+
+    // Check out a free copy of the query. We're using it now
+    Query::LockType query_lock = pool.checkout();
+    Query& query = *query_lock.mutex();
+
+    // Load the parameters. The request outlives the execution, so strings are bound in place
+    const char* invalid = bindRequest( pool, query, data );
+    if ( invalid != nullptr )
+    {
+      std::string err_string( "Invalid request parameter: " );
+      err_string += invalid;
+
+      encoder.fail( err_string.c_str() );
+      return;
+    }
+
+    encodeResponse( query, encoder, &pool.keyset() );
+  }
+
+
+  void executeEncoded( Database& db, const char* name, const rapidjson::Document& data, ResponseEncoder& encoder )
+  {
+    Database::Pin pin( db );
+    executeEncoded( pin.find( name ), data, encoder );
+  }
+
+
+  void executeEncoded( Database& db, const QueryHandle& handle, const rapidjson::Document& data, ResponseEncoder& encoder )
+  {
+    Database::Pin pin( db );
+    executeEncoded( pin.find( handle ), data, encoder );
+  }
+
+
+  // Parse the request into a query the caller has pinned. Null if it doesn't exist
+  static rapidjson::Document executeJsonRaw( QueryPool* found, char* buffer, size_t length )
+  {
+    rapidjson::Document response( rapidjson::kObjectType );
+    rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+
+    if ( found == nullptr )
+    {
+      response.AddMember( "success", false, alloc );
+      response.AddMember( "error", rapidjson::Value( "Invalid request. Does not exist.", alloc ), alloc );
+      response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
+      return response;
+    }
+
+    QueryPool& pool = *found;
+
+    // Check out a free copy of the query. We're using it now
+    Query::LockType query_lock = pool.checkout();
+    Query& query = *query_lock.mutex();
+
+    // Bind each value as it is parsed. The buffer outlives the execution, so strings are bound in place
+    RawRequestBinder binder( pool.plan(), pool.keyset(), query );
+    RawRequestStream stream( buffer, length );
+    rapidjson::Reader reader;
+    reader.Parse< rapidjson::kParseInsituFlag >( stream, binder );
+
+    // A parameter of the wrong type stops the parser, so check for it before any parse error
+    const Parameter* invalid = binder.invalid();
+    if ( invalid == nullptr && reader.HasParseError() )
+    {
+      response.AddMember( "success", false, alloc );
+      response.AddMember( "error", rapidjson::Value( "Invalid request. Expected a JSON object.", alloc ), alloc );
+      response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
+      return response;
+    }
+
+    if ( invalid == nullptr )
+      invalid = binder.missing();
+
+    // Decoded last, so the token wins over any key parameters sent with it
+    const bool bad_cursor = ( invalid == nullptr && binder.hasCursor() && ! pool.keyset().decode( binder.cursor(), query ) );
+
+    if ( invalid != nullptr || bad_cursor )
+    {
+      std::string err_string( "Invalid request parameter: " );
+      err_string += ( invalid != nullptr ? invalid->name().c_str() : "cursor" );
+
+      response.AddMember( "success", false, alloc );
+      response.AddMember( "error", rapidjson::Value( err_string.c_str(), alloc ), alloc );
+      response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
+      return response;
+    }
+
+    executeBound( pool, query, response );
+
+    return response;
+  }
+
+
+  rapidjson::Document executeJsonRaw( Database& db, const char* name, char* buffer, size_t length )
+  {
+    Database::Pin pin( db );
+    return executeJsonRaw( pin.find( name ), buffer, length );
+  }
+
+
+  rapidjson::Document executeJsonRaw( Database& db, const QueryHandle& handle, char* buffer, size_t length )
+  {
+    Database::Pin pin( db );
+    return executeJsonRaw( pin.find( handle ), buffer, length );
+  }
+
+
+  std::future< rapidjson::Document > executeJsonAsync( Database& db, const char* name, const rapidjson::Document& data )
+  {
+    // The request is read later on another thread, so it needs its own copy
+    std::shared_ptr< rapidjson::Document > request = std::make_shared< rapidjson::Document >();
+    request->CopyFrom( data, request->GetAllocator() );
+    std::string query_name( name );
+
+    std::shared_ptr< std::packaged_task< rapidjson::Document() > > job =
+      std::make_shared< std::packaged_task< rapidjson::Document() > >( [&db, query_name, request]()
+        {
+          return executeJson( db, query_name.c_str(), *request );
+        } );
+
+    std::future< rapidjson::Document > result = job->get_future();
+    db.submit( [job]() { (*job)(); } );
+
+    return result;
+  }
+
+
+  void executeJsonAsync( Database& db, const char* name, const rapidjson::Document& data, std::function< void( rapidjson::Document& ) > callback )
+  {
+    // The request is read later on another thread, so it needs its own copy
+    std::shared_ptr< rapidjson::Document > request = std::make_shared< rapidjson::Document >();
+    request->CopyFrom( data, request->GetAllocator() );
+    std::string query_name( name );
+
+    db.submit( [&db, query_name, request, callback]()
+      {
+        rapidjson::Document response;
+
+        // Nothing on the worker thread would catch it, so failures are reported to the callback
+        try
+        {
+          response = executeJson( db, query_name.c_str(), *request );
+        }
+        catch ( std::exception& ex )
+        {
+          std::cerr << "SQLW Error - Asynchronous query " << query_name << " failed: " << ex.what() << std::endl;
+
+          rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+          response.SetObject();
+          response.AddMember( "success", false, alloc );
+          response.AddMember( "error", rapidjson::Value( ex.what(), alloc ), alloc );
+          response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
+        }
+
+        callback( response );
+      } );
+  }
+
+
+  std::future< Status > executeJsonQueued( Database& db, const char* name, const rapidjson::Document& data )
+  {
+    // The write runs later on another thread, so it needs its own copy of the request
+    std::shared_ptr< rapidjson::Document > request = std::make_shared< rapidjson::Document >();
+    request->CopyFrom( data, request->GetAllocator() );
+
+    // The queued copy is executed while the loader, and so the request, is still alive.
+    // Unknown names are reported by the queue, and never reach the loader
+    // The plan belongs to the pinned queries, and their queue commits everything before they are deleted
+    Database::Pin pin( db );
+    QueryPool* pool = pin.find( name );
+    const BindingPlan* plan = ( pool != nullptr ? &pool->plan() : nullptr );
+
+    return db.enqueue( pin, name, [request, plan]( Query& query )
+      {
+        return plan != nullptr && bindJson( *plan, query, *request ) == nullptr;
+      } );
+  }
+
+
+  // Run a batch through a query the caller has pinned. Null if it doesn't exist
+  static rapidjson::Document executeJsonBatch( QueryPool* found, const rapidjson::Document& data )
+  {
+    rapidjson::Document response( rapidjson::kObjectType );
+    rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+
+    if ( found == nullptr )
+    {
+      response.AddMember( "success", false, alloc );
+      response.AddMember( "error", rapidjson::Value( "Invalid request. Does not exist.", alloc ), alloc );
+      response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
+      return response;
+    }
+
+    if ( ! data.IsArray() )
+    {
+      response.AddMember( "success", false, alloc );
+      response.AddMember( "error", rapidjson::Value( "Invalid request. Expected an array of parameter sets.", alloc ), alloc );
+      response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
+      return response;
+    }
+
+    // Check out a free copy of the query. We're using it now
+    QueryPool& pool = *found;
+    Query::LockType query_lock = pool.checkout();
+    Query& query = *query_lock.mutex();
+
+    // Load each parameter set as the batch reaches it
+    const BindingPlan& plan = pool.plan();
+    std::vector< Status > results = query.executeBatch( data.Size(), [&data, &plan]( Query& q, size_t n )
+      {
+        const rapidjson::Value& item = data[ static_cast< rapidjson::SizeType >( n ) ];
+        if ( ! item.IsObject() )
+          return false;
+
+        return bindJson( plan, q, item ) == nullptr;
+      } );
+
+    rapidjson::Value item_data( rapidjson::kArrayType );
+    for ( std::vector< Status >::iterator it = results.begin(); it != results.end(); ++it )
+    {
+      rapidjson::Value item( rapidjson::kObjectType );
+      item.AddMember( "success", it->success, alloc );
+      if ( ! it->success )
+      {
+        item.AddMember( "error", rapidjson::Value( it->error.c_str(), alloc ), alloc );
+      }
+      item_data.PushBack( item, alloc );
+    }
+
+    if ( query.error() )
+    {
+      response.AddMember( "success", false, alloc );
+      response.AddMember( "error", rapidjson::Value( query.getError(), alloc ), alloc );
+    }
+    else
+    {
+      response.AddMember( "success", true, alloc );
+    }
+    response.AddMember( "data", item_data, alloc );
+
+    return response;
+  }
+
+
+  rapidjson::Document executeJsonBatch( Database& db, const char* name, const rapidjson::Document& data )
+  {
+    Database::Pin pin( db );
+    return executeJsonBatch( pin.find( name ), data );
+  }
+
+
+  rapidjson::Document executeJsonBatch( Database& db, const QueryHandle& handle, const rapidjson::Document& data )
+  {
+    Database::Pin pin( db );
+    return executeJsonBatch( pin.find( handle ), data );
+  }
+
+
+  // Add a latency summary as an object member
+  static void addLatency( rapidjson::Value& object, const char* name, const LatencySummary& latency, rapidjson::Document::AllocatorType& alloc )
+  {
+    rapidjson::Value value( rapidjson::kObjectType );
+    value.AddMember( "count", latency.count, alloc );
+    value.AddMember( "mean_ns", latency.mean, alloc );
+    value.AddMember( "p50_ns", latency.p50, alloc );
+    value.AddMember( "p90_ns", latency.p90, alloc );
+    value.AddMember( "p99_ns", latency.p99, alloc );
+    value.AddMember( "max_ns", latency.max, alloc );
+    object.AddMember( rapidjson::StringRef( name ), value, alloc );
+  }
+
+
+  rapidjson::Document statisticsJson( Database& db )
+  {
+    rapidjson::Document response( rapidjson::kObjectType );
+    rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+
+    std::vector< QueryStatistics > stats = db.statistics();
+
+    rapidjson::Value query_data( rapidjson::kArrayType );
+    for ( std::vector< QueryStatistics >::iterator it = stats.begin(); it != stats.end(); ++it )
+    {
+      rapidjson::Value query( rapidjson::kObjectType );
+      query.AddMember( "name", rapidjson::Value( it->name.c_str(), alloc ), alloc );
+      query.AddMember( "executions", it->executions, alloc );
+      query.AddMember( "errors", it->errors, alloc );
+      query.AddMember( "rows", it->rows, alloc );
+      query.AddMember( "bytes", it->bytes, alloc );
+      query.AddMember( "busy_retries", it->busyRetries, alloc );
+      addLatency( query, "query_wait", it->queryWait, alloc );
+      addLatency( query, "connection_wait", it->connectionWait, alloc );
+      addLatency( query, "bind", it->bind, alloc );
+      addLatency( query, "step", it->step, alloc );
+      query_data.PushBack( query, alloc );
+    }
+
+    response.AddMember( "success", true, alloc );
+    response.AddMember( "data", query_data, alloc );
 
     return response;
   }
@@ -0,0 +1,367 @@
+
+#include "KeysetPlan.h"
+#include "Query.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+
+
+namespace SQLW
+{
+
+  const size_t KeysetPlan::npos;
+
+  const char* const KeysetPlan::nullKeyError = "Keyset column is null in the last row. The next page can't be found.";
+
+  // Tokens start with this byte, so the layout can change without misreading old tokens
+  static const unsigned char TOKEN_VERSION = 1;
+
+  // The base64url alphabet. Tokens are passed around in JSON and URLs, so they avoid '+', '/' and padding
+  static const char BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+
+  // FNV-1a of the query name
+  static uint32_t nameHash( const std::string& name )
+  {
+    uint32_t hash = 2166136261u;
+    for ( std::string::const_iterator it = name.begin(); it != name.end(); ++it )
+    {
+      hash ^= static_cast< unsigned char >( *it );
+      hash *= 16777619u;
+    }
+    return hash;
+  }
+
+
+  // Append an unsigned integer in little-endian order
+  static void putBytes( std::string& out, uint64_t value, size_t bytes )
+  {
+    for ( size_t i = 0; i < bytes; ++i )
+    {
+      out.push_back( static_cast< char >( ( value >> ( 8 * i ) ) & 0xff ) );
+    }
+  }
+
+
+  // Read a little-endian unsigned integer, advancing the position. Returns false if the data is too short
+  static bool getBytes( const std::string& in, size_t& pos, uint64_t& value, size_t bytes )
+  {
+    if ( in.size() - pos < bytes )
+      return false;
+
+    value = 0;
+    for ( size_t i = 0; i < bytes; ++i )
+    {
+      value |= static_cast< uint64_t >( static_cast< unsigned char >( in[ pos + i ] ) ) << ( 8 * i );
+    }
+    pos += bytes;
+    return true;
+  }
+
+
+  static std::string toBase64( const std::string& data )
+  {
+    std::string out;
+    out.reserve( ( data.size() * 4 + 2 ) / 3 );
+
+    size_t i = 0;
+    for ( ; i + 2 < data.size(); i += 3 )
+    {
+      uint32_t triple = ( static_cast< unsigned char >( data[i] ) << 16 ) | ( static_cast< unsigned char >( data[i+1] ) << 8 ) | static_cast< unsigned char >( data[i+2] );
+      out.push_back( BASE64_CHARS[ ( triple >> 18 ) & 0x3f ] );
+      out.push_back( BASE64_CHARS[ ( triple >> 12 ) & 0x3f ] );
+      out.push_back( BASE64_CHARS[ ( triple >> 6 ) & 0x3f ] );
+      out.push_back( BASE64_CHARS[ triple & 0x3f ] );
+    }
+
+    if ( i < data.size() )
+    {
+      uint32_t triple = static_cast< unsigned char >( data[i] ) << 16;
+      if ( i + 1 < data.size() )
+        triple |= static_cast< unsigned char >( data[i+1] ) << 8;
+
+      out.push_back( BASE64_CHARS[ ( triple >> 18 ) & 0x3f ] );
+      out.push_back( BASE64_CHARS[ ( triple >> 12 ) & 0x3f ] );
+      if ( i + 1 < data.size() )
+        out.push_back( BASE64_CHARS[ ( triple >> 6 ) & 0x3f ] );
+    }
+
+    return out;
+  }
+
+
+  // Returns false if a character isn't in the alphabet or the length is impossible
+  static bool fromBase64( std::string_view text, std::string& data )
+  {
+    if ( text.size() % 4 == 1 )
+      return false;
+
+    data.clear();
+    data.reserve( text.size() * 3 / 4 );
+
+    uint32_t bits = 0;
+    size_t count = 0;
+    for ( std::string_view::const_iterator it = text.begin(); it != text.end(); ++it )
+    {
+      const char* found = ( *it == '\0' ? nullptr : std::strchr( BASE64_CHARS, *it ) );
+      if ( found == nullptr )
+        return false;
+
+      bits = ( bits << 6 ) | static_cast< uint32_t >( found - BASE64_CHARS );
+      count += 6;
+      if ( count >= 8 )
+      {
+        count -= 8;
+        data.push_back( static_cast< char >( ( bits >> count ) & 0xff ) );
+      }
+    }
+    return true;
+  }
+
+
+  KeysetPlan::KeysetPlan() :
+    _columns(),
+    _parameters(),
+    _limit( npos ),
+    _check( 0 )
+  {
+  }
+
+
+  void KeysetPlan::build( const Query& query, const std::string& name, const CON::Object& config )
+  {
+    _columns.clear();
+    _parameters.clear();
+    _limit = npos;
+    _check = nameHash( name );
+
+    const CON::Object& keys = config["keys"];
+    if ( keys.getSize() == 0 )
+    {
+      std::cerr << "SQLW Error - Keyset for query " << name << " has no keys" << std::endl;
+      throw std::runtime_error( "Keyset without keys." );
+    }
+
+    for ( size_t k = 0; k < keys.getSize(); ++k )
+    {
+      const std::string column_name = keys[k]["column"].asString();
+      const std::string param_name = keys[k]["parameter"].asString();
+
+      size_t column = npos;
+      for ( size_t c = 0; c < query.countColumns() && column == npos; ++c )
+      {
+        if ( query.getColumn( c ).name() == column_name )
+          column = c;
+      }
+
+      size_t param = npos;
+      for ( size_t p = 0; p < query.countParameters() && param == npos; ++p )
+      {
+        if ( query.getParameter( p ).name() == param_name )
+          param = p;
+      }
+
+      if ( column == npos || param == npos )
+      {
+        std::cerr << "SQLW Error - Keyset for query " << name << " refers to an unknown "
+                  << ( column == npos ? "column: " + column_name : "parameter: " + param_name ) << std::endl;
+        throw std::runtime_error( "Unknown keyset key." );
+      }
+
+      if ( query.getColumn( column ).type() != query.getParameter( param ).type() )
+      {
+        std::cerr << "SQLW Error - Keyset for query " << name << " binds column " << column_name
+                  << " to parameter " << param_name << " of a different type" << std::endl;
+        throw std::runtime_error( "Mismatched keyset types." );
+      }
+
+      _columns.push_back( column );
+      _parameters.push_back( param );
+    }
+
+    if ( config.has( "limit" ) )
+    {
+      const std::string limit_name = config["limit"].asString();
+      for ( size_t p = 0; p < query.countParameters() && _limit == npos; ++p )
+      {
+        if ( query.getParameter( p ).name() == limit_name )
+          _limit = p;
+      }
+
+      if ( _limit == npos || query.getParameter( _limit ).type() != Parameter::Int )
+      {
+        std::cerr << "SQLW Error - Keyset limit for query " << name << " is not an int parameter: " << limit_name << std::endl;
+        throw std::runtime_error( "Invalid keyset limit." );
+      }
+    }
+  }
+
+
+  bool KeysetPlan::record( Query& query ) const
+  {
+    for ( size_t k = 0; k < _columns.size(); ++k )
+    {
+      const size_t n = _columns[k];
+      if ( query.columnNull( n ) )
+        return false;
+
+      // Assigning reuses the column's memory, so recording each row doesn't allocate
+      Parameter& column = query.getColumn( n );
+      switch( column.type() )
+      {
+        case Parameter::Int :
+          column.set( query.columnInt( n ) );
+          break;
+
+        case Parameter::Double :
+          column.set( query.columnDouble( n ) );
+          break;
+
+        case Parameter::Bool :
+          column.set( query.columnInt( n ) != 0 );
+          break;
+
+        case Parameter::Text :
+        case Parameter::Blob :
+          column.assign( query.columnView( n ) );
+          break;
+      }
+    }
+    return true;
+  }
+
+
+  bool KeysetPlan::more( const Query& query, size_t rows ) const
+  {
+    if ( rows == 0 )
+      return false;
+
+    // A page shorter than the limit is the last one
+    return _limit == npos || static_cast< int64_t >( rows ) >= static_cast< int64_t >( query.getParameter( _limit ) );
+  }
+
+
+  std::string KeysetPlan::encode( const Query& query ) const
+  {
+    std::string data;
+    data.push_back( static_cast< char >( TOKEN_VERSION ) );
+    putBytes( data, _check, 4 );
+
+    for ( size_t k = 0; k < _columns.size(); ++k )
+    {
+      const Parameter& column = query.getColumn( _columns[k] );
+      switch( column.type() )
+      {
+        case Parameter::Int :
+          putBytes( data, static_cast< uint64_t >( static_cast< int64_t >( column ) ), 8 );
+          break;
+
+        case Parameter::Double :
+          {
+            double value = static_cast< double >( column );
+            uint64_t bits;
+            std::memcpy( &bits, &value, sizeof( bits ) );
+            putBytes( data, bits, 8 );
+          }
+          break;
+
+        case Parameter::Bool :
+          data.push_back( static_cast< bool >( column ) ? 1 : 0 );
+          break;
+
+        case Parameter::Text :
+        case Parameter::Blob :
+          {
+            std::string_view value = column.view();
+            putBytes( data, value.size(), 4 );
+            data.append( value.data(), value.size() );
+          }
+          break;
+      }
+    }
+
+    return toBase64( data );
+  }
+
+
+  bool KeysetPlan::decode( std::string_view token, Query& query ) const
+  {
+    std::string data;
+    if ( ! fromBase64( token, data ) || data.empty() || static_cast< unsigned char >( data[0] ) != TOKEN_VERSION )
+      return false;
+
+    size_t pos = 1;
+    uint64_t check;
+    if ( ! getBytes( data, pos, check, 4 ) || check != _check )
+      return false;
+
+    // Read every value before setting any, so a bad token leaves the parameters alone
+    std::vector< uint64_t > numbers( _parameters.size(), 0 );
+    std::vector< std::string_view > strings( _parameters.size() );
+
+    for ( size_t k = 0; k < _parameters.size(); ++k )
+    {
+      switch( query.getParameter( _parameters[k] ).type() )
+      {
+        case Parameter::Int :
+        case Parameter::Double :
+          if ( ! getBytes( data, pos, numbers[k], 8 ) )
+            return false;
+          break;
+
+        case Parameter::Bool :
+          if ( ! getBytes( data, pos, numbers[k], 1 ) )
+            return false;
+          break;
+
+        case Parameter::Text :
+        case Parameter::Blob :
+          {
+            uint64_t length;
+            if ( ! getBytes( data, pos, length, 4 ) || data.size() - pos < length )
+              return false;
+
+            strings[k] = std::string_view( data.data() + pos, length );
+            pos += length;
+          }
+          break;
+      }
+    }
+
+    if ( pos != data.size() )
+      return false;
+
+    for ( size_t k = 0; k < _parameters.size(); ++k )
+    {
+      Parameter& param = query.getParameter( _parameters[k] );
+      switch( param.type() )
+      {
+        case Parameter::Int :
+          param.set( static_cast< int64_t >( numbers[k] ) );
+          break;
+
+        case Parameter::Double :
+          {
+            double value;
+            std::memcpy( &value, &numbers[k], sizeof( value ) );
+            param.set( value );
+          }
+          break;
+
+        case Parameter::Bool :
+          param.set( numbers[k] != 0 );
+          break;
+
+        case Parameter::Text :
+        case Parameter::Blob :
+          param.assign( strings[k] );
+          break;
+      }
+    }
+
+    return true;
+  }
+
+}
+
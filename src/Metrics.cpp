@@ -0,0 +1,147 @@
+
+#include "Metrics.h"
+
+#include <algorithm>
+
+
+namespace SQLW
+{
+
+  Histogram::Histogram() :
+    _count( 0 ),
+    _sum( 0 ),
+    _max( 0 )
+  {
+    for ( size_t i = 0; i < BucketCount; ++i )
+    {
+      _buckets[i].store( 0, std::memory_order_relaxed );
+    }
+  }
+
+
+  size_t Histogram::bucket( uint64_t value )
+  {
+    // The first 8 buckets are exact
+    if ( value < 8 )
+      return value;
+
+    // After that, 8 linear buckets for every power of two
+    size_t exponent = 63 - __builtin_clzll( value );
+    size_t sub = ( value >> ( exponent - 3 ) ) & 7;
+    return ( exponent - 2 ) * 8 + sub;
+  }
+
+
+  uint64_t Histogram::upperBound( size_t index )
+  {
+    if ( index < 8 )
+      return index;
+
+    size_t exponent = index / 8 + 2;
+    uint64_t width = (uint64_t)1 << ( exponent - 3 );
+    return ( 8 + index % 8 ) * width + ( width - 1 );
+  }
+
+
+  void Histogram::record( uint64_t value )
+  {
+    _buckets[ bucket( value ) ].fetch_add( 1, std::memory_order_relaxed );
+    _count.fetch_add( 1, std::memory_order_relaxed );
+    _sum.fetch_add( value, std::memory_order_relaxed );
+
+    uint64_t current = _max.load( std::memory_order_relaxed );
+    while ( value > current && ! _max.compare_exchange_weak( current, value, std::memory_order_relaxed ) );
+  }
+
+
+  uint64_t Histogram::mean() const
+  {
+    uint64_t count = this->count();
+    return count == 0 ? 0 : _sum.load( std::memory_order_relaxed ) / count;
+  }
+
+
+  uint64_t Histogram::percentile( double fraction ) const
+  {
+    uint64_t count = this->count();
+    if ( count == 0 )
+      return 0;
+
+    // Rank of the value we're looking for, counting from 1
+    uint64_t rank = (uint64_t)( fraction * count + 0.5 );
+    if ( rank == 0 ) rank = 1;
+
+    uint64_t total = 0;
+    for ( size_t i = 0; i < BucketCount; ++i )
+    {
+      total += _buckets[i].load( std::memory_order_relaxed );
+      if ( total >= rank )
+      {
+        return std::min( upperBound( i ), this->max() );
+      }
+    }
+
+    // Buckets were still being updated
+    return this->max();
+  }
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  QueryMetrics::QueryMetrics() :
+    _executions( 0 ),
+    _errors( 0 ),
+    _rows( 0 ),
+    _bytes( 0 ),
+    _busyRetries( 0 ),
+    _queryWait(),
+    _connectionWait(),
+    _bind(),
+    _step()
+  {
+  }
+
+
+  void QueryMetrics::execution( bool error, uint64_t rows, uint64_t bytes, uint64_t step )
+  {
+    _executions.fetch_add( 1, std::memory_order_relaxed );
+    if ( error )
+      _errors.fetch_add( 1, std::memory_order_relaxed );
+
+    _rows.fetch_add( rows, std::memory_order_relaxed );
+    _bytes.fetch_add( bytes, std::memory_order_relaxed );
+    _step.record( step );
+  }
+
+
+  LatencySummary QueryMetrics::summarise( const Histogram& histogram )
+  {
+    LatencySummary summary;
+    summary.count = histogram.count();
+    summary.mean = histogram.mean();
+    summary.p50 = histogram.percentile( 0.50 );
+    summary.p90 = histogram.percentile( 0.90 );
+    summary.p99 = histogram.percentile( 0.99 );
+    summary.max = histogram.max();
+    return summary;
+  }
+
+
+  QueryStatistics QueryMetrics::snapshot( const std::string& name ) const
+  {
+    QueryStatistics stats;
+    stats.name = name;
+    stats.executions = _executions.load( std::memory_order_relaxed );
+    stats.errors = _errors.load( std::memory_order_relaxed );
+    stats.rows = _rows.load( std::memory_order_relaxed );
+    stats.bytes = _bytes.load( std::memory_order_relaxed );
+    stats.busyRetries = _busyRetries.load( std::memory_order_relaxed );
+    stats.queryWait = summarise( _queryWait );
+    stats.connectionWait = summarise( _connectionWait );
+    stats.bind = summarise( _bind );
+    stats.step = summarise( _step );
+    return stats;
+  }
+
+}
+
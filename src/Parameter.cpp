@@ -9,7 +9,11 @@ namespace SQLW
 
   Parameter::Parameter( std::string name, Parameter::Type t ) :
     _name( name ),
-    _type( t )
+    _type( t ),
+    _view(),
+    _useView( false ),
+    _zeroLength( 0 ),
+    _useZero( false )
   {
     switch( _type )
     {
@@ -34,7 +38,11 @@ namespace SQLW
 
   Parameter::Parameter( const Parameter& p ) :
     _name( p._name ),
-    _type( p._type )
+    _type( p._type ),
+    _view( p._view ),
+    _useView( p._useView ),
+    _zeroLength( p._zeroLength ),
+    _useZero( p._useZero )
   {
     switch( _type )
     {
@@ -59,7 +67,11 @@ namespace SQLW
 
   Parameter::Parameter( Parameter&& p ) :
     _name( std::move( p._name ) ),
-    _type( std::move( p._type ) )
+    _type( std::move( p._type ) ),
+    _view( p._view ),
+    _useView( p._useView ),
+    _zeroLength( p._zeroLength ),
+    _useZero( p._useZero )
   {
     switch( _type )
     {
@@ -108,7 +120,10 @@ namespace SQLW
     switch( _type )
     {
       case Text :
-        sqlite3_bind_text( stmt, index, _text.c_str(), _text.size(), nullptr );
+        if ( _useView )
+          sqlite3_bind_text( stmt, index, _view.data(), _view.size(), SQLITE_STATIC );
+        else
+          sqlite3_bind_text( stmt, index, _text.c_str(), _text.size(), nullptr );
         break;
 
       case Int :
@@ -120,11 +135,16 @@ namespace SQLW
         break;
 
       case Blob :
-        sqlite3_bind_blob( stmt, index, (const void*)_blob.c_str(), _blob.size(), nullptr );
+        if ( _useZero )
+          sqlite3_bind_zeroblob64( stmt, index, _zeroLength );
+        else if ( _useView )
+          sqlite3_bind_blob( stmt, index, (const void*)_view.data(), _view.size(), SQLITE_STATIC );
+        else
+          sqlite3_bind_blob( stmt, index, (const void*)_blob.c_str(), _blob.size(), nullptr );
         break;
 
       case Double :
-        sqlite3_bind_int64( stmt, index, _double );
+        sqlite3_bind_double( stmt, index, _double );
         break;
     }
   }
@@ -136,8 +156,12 @@ namespace SQLW
     {
       case Parameter::Text :
         {
+          // Assign reuses the string's capacity, so steady state rows don't allocate
           const char* temp = (const char*)sqlite3_column_text( stmt, index );
-          _text = ( temp ? temp : "" );
+          if ( temp )
+            _text.assign( temp, sqlite3_column_bytes( stmt, index ) );
+          else
+            _text.clear();
         }
         break;
 
@@ -151,13 +175,17 @@ namespace SQLW
 
       case Parameter::Blob :
         {
-          const char* temp = (const char*)sqlite3_column_text( stmt, index );
-          _blob = ( temp ? temp : "" );
+          // Blobs can contain nulls, so copy by length
+          const char* temp = (const char*)sqlite3_column_blob( stmt, index );
+          if ( temp )
+            _blob.assign( temp, sqlite3_column_bytes( stmt, index ) );
+          else
+            _blob.clear();
         }
         break;
 
       case Parameter::Double :
-        _double = sqlite3_column_int64( stmt, index );
+        _double = sqlite3_column_double( stmt, index );
         break;
     }
   }
@@ -244,7 +272,9 @@ namespace SQLW
   Parameter::operator std::string() const
   {
     assert( _type == Parameter::Text || _type == Blob );
-    if ( _type == Parameter::Text )
+    if ( _useView )
+      return std::string( _view );
+    else if ( _type == Parameter::Text )
       return _text;
     else
       return _blob;
@@ -292,10 +322,12 @@ namespace SQLW
   void Parameter::set( std::string val )
   {
     assert( _type == Parameter::Text || _type == Parameter::Blob );
+    _useView = false;
+    _useZero = false;
     if ( _type == Text )
-      _text = val;
+      _text = std::move( val );
     else
-      _blob = val;
+      _blob = std::move( val );
   }
 
 
@@ -316,15 +348,84 @@ namespace SQLW
   void Parameter::set( void* val )
   {
     assert( _type == Parameter::Blob );
+    _useView = false;
+    _useZero = false;
     _blob = (const char*) val;
   }
 
 
+  void Parameter::set( const void* val, size_t length )
+  {
+    assert( _type == Parameter::Blob );
+    _useView = false;
+    _useZero = false;
+    _blob.assign( (const char*) val, length );
+  }
+
+
+  void Parameter::assign( std::string_view val )
+  {
+    assert( _type == Parameter::Text || _type == Parameter::Blob );
+    _useView = false;
+    _useZero = false;
+    if ( _type == Text )
+      _text.assign( val.data(), val.size() );
+    else
+      _blob.assign( val.data(), val.size() );
+  }
+
+
   void Parameter::set( double val )
   {
     assert( _type == Parameter::Double );
     _double = val;
   }
 
+
+  void Parameter::bindView( std::string_view val )
+  {
+    assert( _type == Parameter::Text || _type == Parameter::Blob );
+    _view = val;
+    _useView = true;
+    _useZero = false;
+  }
+
+
+  bool Parameter::releaseView()
+  {
+    if ( ! _useView )
+      return false;
+
+    _view = std::string_view();
+    _useView = false;
+    if ( _type == Text )
+      _text.clear();
+    else
+      _blob.clear();
+    return true;
+  }
+
+
+  void Parameter::bindZeroBlob( size_t length )
+  {
+    assert( _type == Parameter::Blob );
+    _zeroLength = length;
+    _useZero = true;
+    _useView = false;
+  }
+
+
+
+  std::string_view Parameter::view() const
+  {
+    assert( _type == Parameter::Text || _type == Parameter::Blob );
+    if ( _useView )
+      return _view;
+    else if ( _type == Parameter::Text )
+      return std::string_view( _text );
+    else
+      return std::string_view( _blob );
+  }
+
 }
 
@@ -0,0 +1,295 @@
+
+#include "PerformanceProfile.h"
+
+#include <iostream>
+
+
+namespace SQLW
+{
+
+  // Every pragma the profile can set. The order they are applied and reported in
+  static const char* const PragmaOrder[] =
+  {
+    "page_size",
+    "journal_mode",
+    "synchronous",
+    "cache_size",
+    "mmap_size",
+    "temp_store",
+    "busy_timeout"
+  };
+
+  static const size_t PragmaCount = sizeof( PragmaOrder ) / sizeof( PragmaOrder[0] );
+
+
+  // Returns true if the value is in the null terminated list of choices
+  static bool oneOf( const std::string& value, const char* const* choices )
+  {
+    for ( ; *choices != nullptr; ++choices )
+    {
+      if ( sqlite3_stricmp( value.c_str(), *choices ) == 0 )
+        return true;
+    }
+    return false;
+  }
+
+
+  // Position of a pragma in the order above
+  static size_t pragmaRank( const std::string& name )
+  {
+    size_t i = 0;
+    while ( i < PragmaCount && name != PragmaOrder[i] ) ++i;
+    return i;
+  }
+
+
+  PerformanceProfile::PerformanceProfile() :
+    _pragmas(),
+    _lookasideSize( 0 ),
+    _lookasideCount( 0 )
+  {
+  }
+
+
+  void PerformanceProfile::set( const std::string& name, const std::string& value )
+  {
+    const size_t rank = pragmaRank( name );
+
+    Settings::iterator it = _pragmas.begin();
+    while ( it != _pragmas.end() && pragmaRank( it->first ) < rank ) ++it;
+
+    if ( it != _pragmas.end() && it->first == name )
+      it->second = value;
+    else
+      _pragmas.insert( it, std::make_pair( name, value ) );
+  }
+
+
+  void PerformanceProfile::preset( const std::string& name )
+  {
+    if ( name == "read_heavy" )
+    {
+      this->set( "journal_mode", "wal" );
+      this->set( "synchronous", "normal" );
+      this->set( "cache_size", "-65536" );
+      this->set( "mmap_size", "268435456" );
+      this->set( "temp_store", "memory" );
+    }
+    else if ( name == "bulk_load" )
+    {
+      this->set( "journal_mode", "wal" );
+      this->set( "synchronous", "off" );
+      this->set( "cache_size", "-262144" );
+      this->set( "temp_store", "memory" );
+    }
+    else if ( name == "durable" )
+    {
+      this->set( "journal_mode", "wal" );
+      this->set( "synchronous", "full" );
+      this->set( "mmap_size", "0" );
+    }
+    else
+    {
+      std::cerr << "SQLW Error - Unknown performance preset: " << name << std::endl;
+      throw std::runtime_error( "Unknown performance preset." );
+    }
+  }
+
+
+  void PerformanceProfile::configure( const CON::Object& config )
+  {
+    static const char* const journal_modes[] = { "delete", "truncate", "persist", "memory", "wal", "off", nullptr };
+    static const char* const synchronous[] = { "off", "normal", "full", "extra", nullptr };
+    static const char* const temp_stores[] = { "default", "file", "memory", nullptr };
+
+    if ( config.has( "preset" ) )
+    {
+      this->preset( config["preset"].asString() );
+    }
+
+    if ( config.has( "journal_mode" ) )
+    {
+      std::string value = config["journal_mode"].asString();
+      if ( ! oneOf( value, journal_modes ) )
+      {
+        std::cerr << "SQLW Error - Invalid journal_mode: " << value << std::endl;
+        throw std::runtime_error( "Invalid performance setting." );
+      }
+      this->set( "journal_mode", value );
+    }
+
+    if ( config.has( "synchronous" ) )
+    {
+      std::string value = config["synchronous"].asString();
+      if ( ! oneOf( value, synchronous ) )
+      {
+        std::cerr << "SQLW Error - Invalid synchronous setting: " << value << std::endl;
+        throw std::runtime_error( "Invalid performance setting." );
+      }
+      this->set( "synchronous", value );
+    }
+
+    if ( config.has( "temp_store" ) )
+    {
+      std::string value = config["temp_store"].asString();
+      if ( ! oneOf( value, temp_stores ) )
+      {
+        std::cerr << "SQLW Error - Invalid temp_store: " << value << std::endl;
+        throw std::runtime_error( "Invalid performance setting." );
+      }
+      this->set( "temp_store", value );
+    }
+
+    if ( config.has( "page_size" ) )
+    {
+      int value = config["page_size"].asInt();
+      if ( value < 512 || value > 65536 || ( value & ( value - 1 ) ) != 0 )
+      {
+        std::cerr << "SQLW Error - Invalid page_size: " << value << ". Must be a power of two from 512 to 65536" << std::endl;
+        throw std::runtime_error( "Invalid performance setting." );
+      }
+      this->set( "page_size", std::to_string( value ) );
+    }
+
+    // Negative cache sizes are in KiB, positive ones in pages
+    if ( config.has( "cache_size" ) )
+    {
+      this->set( "cache_size", std::to_string( static_cast< int64_t >( config["cache_size"].asInt() ) ) );
+    }
+
+    if ( config.has( "mmap_size" ) )
+    {
+      int64_t value = config["mmap_size"].asInt();
+      if ( value < 0 )
+      {
+        std::cerr << "SQLW Error - Invalid mmap_size: " << value << std::endl;
+        throw std::runtime_error( "Invalid performance setting." );
+      }
+      this->set( "mmap_size", std::to_string( value ) );
+    }
+
+    if ( config.has( "busy_timeout" ) )
+    {
+      int value = config["busy_timeout"].asInt();
+      if ( value < 0 )
+      {
+        std::cerr << "SQLW Error - Invalid busy_timeout: " << value << std::endl;
+        throw std::runtime_error( "Invalid performance setting." );
+      }
+      this->set( "busy_timeout", std::to_string( value ) );
+    }
+
+    if ( config.has( "lookaside_size" ) || config.has( "lookaside_count" ) )
+    {
+      if ( ! config.has( "lookaside_size" ) || ! config.has( "lookaside_count" ) )
+      {
+        std::cerr << "SQLW Error - lookaside_size and lookaside_count must be set together" << std::endl;
+        throw std::runtime_error( "Invalid performance setting." );
+      }
+
+      _lookasideSize = config["lookaside_size"].asInt();
+      _lookasideCount = config["lookaside_count"].asInt();
+
+      if ( _lookasideSize < 0 || _lookasideCount < 0 || _lookasideSize % 8 != 0 )
+      {
+        std::cerr << "SQLW Error - Invalid lookaside: " << _lookasideCount << " slots of " << _lookasideSize << " bytes" << std::endl;
+        throw std::runtime_error( "Invalid performance setting." );
+      }
+    }
+  }
+
+
+  void PerformanceProfile::apply( sqlite3* database, bool writer ) const
+  {
+    // Must come before anything uses the connection
+    if ( _lookasideSize > 0 || _lookasideCount > 0 )
+    {
+      if ( sqlite3_db_config( database, SQLITE_DBCONFIG_LOOKASIDE, nullptr, _lookasideSize, _lookasideCount ) != SQLITE_OK )
+      {
+        std::cerr << "SQLW Error - Failed to configure lookaside: " << sqlite3_errmsg( database ) << std::endl;
+        throw std::runtime_error( "Failed to apply performance settings." );
+      }
+    }
+
+    for ( Settings::const_iterator it = _pragmas.begin(); it != _pragmas.end(); ++it )
+    {
+      if ( ! writer && ( it->first == "journal_mode" || it->first == "page_size" ) )
+        continue;
+
+      std::string result = pragma( database, it->first + "=" + it->second );
+
+      // Sqlite reports the mode it ended up in, rather than an error
+      if ( it->first == "journal_mode" && sqlite3_stricmp( result.c_str(), it->second.c_str() ) != 0 )
+      {
+        std::cerr << "SQLW Error - Failed to set journal_mode to " << it->second << ". Database is using: " << result << std::endl;
+        throw std::runtime_error( "Failed to apply performance settings." );
+      }
+    }
+  }
+
+
+  std::string PerformanceProfile::get( const std::string& name ) const
+  {
+    for ( Settings::const_iterator it = _pragmas.begin(); it != _pragmas.end(); ++it )
+    {
+      if ( it->first == name )
+        return it->second;
+    }
+    return std::string();
+  }
+
+
+  PerformanceProfile::Settings PerformanceProfile::effective( sqlite3* database )
+  {
+    static const char* const synchronous[] = { "off", "normal", "full", "extra" };
+    static const char* const temp_stores[] = { "default", "file", "memory" };
+
+    Settings settings;
+    for ( size_t i = 0; i < PragmaCount; ++i )
+    {
+      std::string value = pragma( database, PragmaOrder[i] );
+
+      // Report the names used in the configuration, rather than sqlite's numbers
+      if ( PragmaOrder[i] == std::string( "synchronous" ) && value.size() == 1 && value[0] >= '0' && value[0] <= '3' )
+        value = synchronous[ value[0] - '0' ];
+      else if ( PragmaOrder[i] == std::string( "temp_store" ) && value.size() == 1 && value[0] >= '0' && value[0] <= '2' )
+        value = temp_stores[ value[0] - '0' ];
+
+      settings.push_back( std::make_pair( std::string( PragmaOrder[i] ), value ) );
+    }
+    return settings;
+  }
+
+
+  std::string PerformanceProfile::pragma( sqlite3* database, const std::string& text )
+  {
+    std::string statement_text = "PRAGMA " + text + ";";
+    sqlite3_stmt* statement = nullptr;
+
+    int result = sqlite3_prepare_v2( database, statement_text.c_str(), -1, &statement, nullptr );
+    if ( result != SQLITE_OK )
+    {
+      std::cerr << "SQLW Error - Failed to run " << statement_text << " : " << sqlite3_errmsg( database ) << std::endl;
+      sqlite3_finalize( statement );
+      throw std::runtime_error( "Failed to apply performance settings." );
+    }
+
+    std::string value;
+    result = sqlite3_step( statement );
+    if ( result == SQLITE_ROW && sqlite3_column_text( statement, 0 ) != nullptr )
+    {
+      value = (const char*)sqlite3_column_text( statement, 0 );
+    }
+    else if ( result != SQLITE_ROW && result != SQLITE_DONE )
+    {
+      std::cerr << "SQLW Error - Failed to run " << statement_text << " : " << sqlite3_errmsg( database ) << std::endl;
+      sqlite3_finalize( statement );
+      throw std::runtime_error( "Failed to apply performance settings." );
+    }
+
+    sqlite3_finalize( statement );
+    return value;
+  }
+
+}
+
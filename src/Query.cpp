@@ -1,30 +1,45 @@
 
 #include "Query.h"
 #include "Database.h"
+#include "ResultCache.h"
+#include "ColumnBatch.h"
+
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
 
 #include <iostream>
 #include <thread>
+#include <algorithm>
 
 
 namespace SQLW
 {
 
-  Query::Query( Connection& con, const CON::Object& config ) :
+  Query::Query( Connection& con, const CON::Object& config, bool lazy ) :
     _connection( con ),
     _connectionLock( _connection.mutex, std::defer_lock ),
     _theStatement( nullptr ),
+    _prepared(),
     _name( config["name"].asString() ),
     _description( config["description"].asString() ),
     _statementText( config["statement"].asString() ),
-    _error( nullptr )
+    _declaredReadOnly( config.has( "read_only" ) && config["read_only"].asInt() != 0 ),
+    _error( nullptr ),
+    _busyPolicy( _connection.busy ),
+    _ownsBusyPolicy( false ),
+    _started( false ),
+    _finished( false ),
+    _metrics( nullptr ),
+    _rowCount( 0 ),
+    _byteCount( 0 ),
+    _stepTime( 0 )
   {
-    int result = sqlite3_prepare_v3( _connection.database, _statementText.c_str(), _statementText.size(), SQLITE_PREPARE_PERSISTENT, &_theStatement, nullptr );
-
-    if ( result != SQLITE_OK || _theStatement == nullptr )
+    // Queries may override the database's retry policy
+    if ( BusyPolicy::configured( config ) )
     {
-      std::cerr << "SQLW Error - Failed to prepare query: " << _name << ". Error " << result << " : " << sqlite3_errmsg( _connection.database ) << std::endl;
-      throw std::runtime_error( "Failed to prepare query." );
-    } 
+      _busyPolicy = new BusyPolicy( *_connection.busy, config );
+      _ownsBusyPolicy = true;
+    }
 
     const CON::Object& parameters = config["parameters"];
     for ( size_t i = 0; i < parameters.getSize(); ++i )
@@ -89,6 +104,92 @@ namespace SQLW
         throw std::runtime_error( "Unknown column type." );
       }
     }
+
+    rapidjson::StringBuffer buffer;
+    for ( ColumnIterator c_it = _columns.begin(); c_it != _columns.end(); ++c_it )
+    {
+      rapidjson::Writer< rapidjson::StringBuffer > writer( buffer );
+      writer.String( c_it->name().c_str(), c_it->name().size() );
+      _columnKeys.push_back( std::string( buffer.GetString(), buffer.GetSize() ) );
+      buffer.Clear();
+    }
+
+    if ( ! lazy )
+    {
+      this->ensurePrepared();
+    }
+  }
+
+
+  void Query::prepareStatement()
+  {
+    // Record the tables the statement touches, so cached results can be invalidated
+    sqlite3_set_authorizer( _connection.database, Query::recordTables, this );
+    int result = sqlite3_prepare_v3( _connection.database, _statementText.c_str(), _statementText.size(), SQLITE_PREPARE_PERSISTENT, &_theStatement, nullptr );
+    sqlite3_set_authorizer( _connection.database, nullptr, nullptr );
+
+    if ( result != SQLITE_OK || _theStatement == nullptr )
+    {
+      std::cerr << "SQLW Error - Failed to prepare query: " << _name << ". Error " << result << " : " << sqlite3_errmsg( _connection.database ) << std::endl;
+      sqlite3_finalize( _theStatement );
+      _theStatement = nullptr;
+      _readTables.clear();
+      _writeTables.clear();
+      throw std::runtime_error( "Failed to prepare query." );
+    }
+
+    // Declared read-only queries are sent to the readers without being checked, so check them now
+    if ( _declaredReadOnly && ! sqlite3_stmt_readonly( _theStatement ) )
+    {
+      std::cerr << "SQLW Error - Query declared read_only writes to the database: " << _name << std::endl;
+      sqlite3_finalize( _theStatement );
+      _theStatement = nullptr;
+      _readTables.clear();
+      _writeTables.clear();
+      throw std::runtime_error( "Query declared read-only writes to the database." );
+    }
+  }
+
+
+  void Query::ensurePrepared()
+  {
+    // The authorizer belongs to the connection, so nothing else may use it while preparing.
+    // If preparing throws, the next call tries again.
+    std::call_once( _prepared, [this]()
+      {
+        std::lock_guard< std::mutex > lock( _connection.mutex );
+        this->prepareStatement();
+      } );
+  }
+
+
+  int Query::recordTables( void* data, int action, const char* table, const char*, const char*, const char* )
+  {
+    Query* query = static_cast< Query* >( data );
+    std::vector< std::string >* tables;
+
+    switch( action )
+    {
+      case SQLITE_READ :
+        tables = &query->_readTables;
+        break;
+
+      case SQLITE_INSERT :
+      case SQLITE_UPDATE :
+      case SQLITE_DELETE :
+        tables = &query->_writeTables;
+        break;
+
+      default :
+        return SQLITE_OK;
+    }
+
+    if ( table != nullptr && std::find( tables->begin(), tables->end(), table ) == tables->end() )
+    {
+      tables->push_back( table );
+    }
+
+    return SQLITE_OK;
   }
 
 
@@ -103,6 +204,9 @@ namespace SQLW
 
     if ( _theStatement != nullptr )
       sqlite3_finalize( _theStatement );
+
+    if ( _ownsBusyPolicy )
+      delete _busyPolicy;
   }
 
 
@@ -201,6 +305,35 @@ namespace SQLW
 
   void Query::prepare()
   {
+    this->ensurePrepared();
+    this->bindParameters();
+
+    // Now we lock the connection ready to run the query
+    this->lockConnection();
+  }
+
+
+  void Query::lockConnection()
+  {
+    if ( _metrics != nullptr )
+    {
+      QueryMetrics::Clock::time_point start = QueryMetrics::Clock::now();
+      _connectionLock.lock();
+      _metrics->connectionWait( QueryMetrics::since( start ) );
+    }
+    else
+    {
+      _connectionLock.lock();
+    }
+  }
+
+
+  void Query::bindParameters()
+  {
+    QueryMetrics::Clock::time_point start;
+    if ( _metrics != nullptr )
+      start = QueryMetrics::Clock::now();
+
     size_t index = 1;
     for ( ParameterVector::iterator p_it = _parameters.begin(); p_it != _parameters.end(); ++p_it, ++index )
     {
@@ -208,31 +341,71 @@ namespace SQLW
       p_it->assignStatement( _theStatement, index );
     }
 
-    // Now we lock the connection ready to run the query
-    _connectionLock.lock();
+    if ( _metrics != nullptr )
+      _metrics->bind( QueryMetrics::since( start ) );
   }
 
 
-  bool Query::step()
+  void Query::recordExecution()
   {
-    size_t temp;
-    unsigned count = 0;
+    _metrics->execution( _error != nullptr, _rowCount, _byteCount, _stepTime );
+    _rowCount = 0;
+    _byteCount = 0;
+    _stepTime = 0;
+  }
+
+
+  bool Query::stepStatement()
+  {
+    QueryMetrics::Clock::time_point start;
+    if ( _metrics != nullptr )
+      start = QueryMetrics::Clock::now();
+
+    int temp;
+    unsigned attempt = 0;
     while ( temp = sqlite3_step( _theStatement ), temp == SQLITE_BUSY )
     {
-      if ( count == 10 )
+      // Nothing has been read and no transaction is open, so let others use the connection while we wait.
+      // Inside a transaction (batches, the write queue) the connection has to stay ours.
+      bool release = ! _started && _connectionLock.owns_lock() && sqlite3_get_autocommit( _connection.database );
+
+      if ( release )
+        _connectionLock.unlock();
+
+      bool retry = _busyPolicy->wait( attempt++ );
+
+      if ( release )
+        _connectionLock.lock();
+
+      if ( ! retry )
       {
         // Set error status
         _error = "Database busy. Failed to access after repeated retries.";
-        return false;
+        break;
       }
-      count += 1;
-      std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
     }
 
+    if ( _metrics != nullptr )
+    {
+      _stepTime += QueryMetrics::since( start );
+      if ( attempt > 0 )
+        _metrics->busy( attempt );
+
+      if ( temp == SQLITE_ROW )
+      {
+        _rowCount += 1;
+        for ( int i = 0; i < sqlite3_column_count( _theStatement ); ++i )
+        {
+          int type = sqlite3_column_type( _theStatement, i );
+          _byteCount += ( type == SQLITE_TEXT || type == SQLITE_BLOB ) ? sqlite3_column_bytes( _theStatement, i ) : ( type == SQLITE_NULL ? 0 : 8 );
+        }
+      }
+    }
 
     // Check status for our next option
-    if ( temp == SQLITE_DONE )
+    if ( temp == SQLITE_DONE || temp == SQLITE_BUSY )
     {
+      _finished = ( temp == SQLITE_DONE );
       return false;
     }
     else if ( temp != SQLITE_ROW )
@@ -241,12 +414,22 @@ namespace SQLW
       return false;
     }
 
+    _started = true;
+    return true;
+  }
+
+
+  bool Query::step()
+  {
+    if ( ! this->stepStatement() )
+      return false;
+
     // Fetch the column data
-    temp = 0;
-    for ( ParameterVector::iterator c_it = _columns.begin(); c_it != _columns.end(); ++c_it, ++temp )
+    size_t index = 0;
+    for ( ParameterVector::iterator c_it = _columns.begin(); c_it != _columns.end(); ++c_it, ++index )
     {
       // Load the returned value from the statement
-      c_it->readStatement( _theStatement, temp );
+      c_it->readStatement( _theStatement, index );
     }
 
     // Ready for the next step
@@ -254,27 +437,236 @@ namespace SQLW
   }
 
 
+  bool Query::stepView()
+  {
+    return this->stepStatement();
+  }
+
+
+  size_t Query::fetchBatch( ColumnBatch& batch, size_t count )
+  {
+    batch.clear();
+    if ( _finished )
+      return 0;
+
+    batch.reserve( count );
+
+    while ( batch.rows() < count && this->stepStatement() )
+    {
+      batch.append( _theStatement );
+    }
+
+    return batch.rows();
+  }
+
+
+  std::string_view Query::columnView( size_t n ) const
+  {
+    // Fetch the pointer before the size, so sqlite reports the size of the converted value
+    const char* data;
+    if ( _columns[ n ].type() == Parameter::Blob )
+      data = (const char*)sqlite3_column_blob( _theStatement, n );
+    else
+      data = (const char*)sqlite3_column_text( _theStatement, n );
+
+    if ( data == nullptr )
+      return std::string_view( "", 0 );
+
+    return std::string_view( data, sqlite3_column_bytes( _theStatement, n ) );
+  }
+
+
   void Query::reset()
   {
     // Clean up the mess and importantly release access to the connection!
+    sqlite3_reset( _theStatement );
+    _started = false;
+    _finished = false;
+
+    if ( _metrics != nullptr )
+      this->recordExecution();
+
+    // The statement has finished, so any write it made has committed (unless we're in a transaction)
+    if ( _connection.caches != nullptr )
+    {
+      this->markWritten();
+      _connection.caches->flush( _connection.database );
+    }
+
+    this->releaseViews();
+
     _connectionLock.unlock();
+  }
+
+
+  void Query::releaseViews()
+  {
+    bool released = false;
+    for ( ParameterVector::iterator it = _parameters.begin(); it != _parameters.end(); ++it )
+    {
+      released = it->releaseView() || released;
+    }
+
+    if ( released && _theStatement != nullptr )
+      sqlite3_clear_bindings( _theStatement );
+  }
+
+
+  void Query::markWritten()
+  {
+    // The update hook misses some writes (e.g. the truncate optimisation), so use what the statement declared too
+    for ( std::vector< std::string >::iterator it = _writeTables.begin(); it != _writeTables.end(); ++it )
+    {
+      _connection.caches->modified( *it );
+    }
+  }
+
+
+  void Query::execute( Status& status )
+  {
+    _error = nullptr;
+
+    this->bindParameters();
+
+    while ( this->stepStatement() );
+
+    // Copy the error before the reset can replace it
+    if ( _error != nullptr )
+    {
+      status.success = false;
+      status.error = _error;
+    }
+    else
+    {
+      status.success = true;
+      status.error.clear();
+    }
+
     sqlite3_reset( _theStatement );
+    _started = false;
+    _finished = false;
+
+    if ( _metrics != nullptr )
+      this->recordExecution();
+
+    if ( _connection.caches != nullptr )
+      this->markWritten();
+  }
+
+
+  std::vector< Status > Query::executeBatch( size_t count, const BatchLoader& loader )
+  {
+    std::vector< Status > results( count, Status{ false, "" } );
+
+    this->ensurePrepared();
+    this->lockConnection();
+
+    // Read-only connections can't take the write lock up front
+    if ( ! transaction( _connection, ( this->readOnly() ? "BEGIN;" : "BEGIN IMMEDIATE;" ) ) )
+    {
+      _error = "Failed to begin batch transaction.";
+    }
+    else
+    {
+      try
+      {
+        for ( size_t i = 0; i < count; ++i )
+        {
+          if ( ! loader( *this, i ) )
+          {
+            results[i].error = "Invalid request parameters.";
+            continue;
+          }
+
+          this->execute( results[i] );
+
+          // Some errors (e.g. disk full) roll back the whole transaction, not just the statement
+          if ( ! results[i].success && sqlite3_get_autocommit( _connection.database ) )
+          {
+            break;
+          }
+        }
+      }
+      catch ( ... )
+      {
+        // Left open, the transaction would swallow every later write on the connection
+        sqlite3_reset( _theStatement );
+        if ( ! sqlite3_get_autocommit( _connection.database ) )
+          transaction( _connection, "ROLLBACK;" );
+
+        _connectionLock.unlock();
+        throw;
+      }
+
+      if ( sqlite3_get_autocommit( _connection.database ) )
+      {
+        _error = "Batch transaction was rolled back.";
+      }
+      else if ( ! transaction( _connection, "COMMIT;" ) )
+      {
+        transaction( _connection, "ROLLBACK;" );
+        _error = "Failed to commit batch transaction.";
+      }
+      else
+      {
+        _error = nullptr;
+      }
+    }
+
+    if ( _error != nullptr )
+    {
+      for ( std::vector< Status >::iterator it = results.begin(); it != results.end(); ++it )
+      {
+        it->success = false;
+        it->error = _error;
+      }
+    }
+
+    _connectionLock.unlock();
+
+    return results;
   }
 
 
   void Query::lock()
   {
-    _theMutex.lock();
+    if ( _metrics != nullptr )
+    {
+      QueryMetrics::Clock::time_point start = QueryMetrics::Clock::now();
+      _theMutex.lock();
+      _metrics->queryWait( QueryMetrics::since( start ) );
+    }
+    else
+    {
+      _theMutex.lock();
+    }
     _error = nullptr;
   }
 
 
+  bool Query::try_lock()
+  {
+    if ( ! _theMutex.try_lock() )
+      return false;
+
+    // Got it without waiting
+    if ( _metrics != nullptr )
+      _metrics->queryWait( 0 );
+
+    _error = nullptr;
+    return true;
+  }
+
+
   void Query::unlock()
   {
     // Clean up in case something catastrophic happened
     if ( _connectionLock.owns_lock() )
       this->reset();
 
+    // Batches finish without a reset, and the next user mustn't see this one's views
+    this->releaseViews();
+
     _theMutex.unlock();
   }
 }
@@ -0,0 +1,93 @@
+
+#include "QueryPool.h"
+
+
+namespace SQLW
+{
+
+  QueryPool::QueryPool( std::string name ) :
+    _name( name ),
+    _queries(),
+    _next( 0 ),
+    _cache( nullptr ),
+    _metrics( nullptr ),
+    _plan(),
+    _keyset()
+  {
+  }
+
+
+  QueryPool::~QueryPool()
+  {
+    for ( QueryVector::iterator it = _queries.begin(); it != _queries.end(); ++it )
+    {
+      delete (*it);
+    }
+    _queries.clear();
+
+    delete _cache;
+    delete _metrics;
+  }
+
+
+  void QueryPool::add( Query* query )
+  {
+    if ( _queries.empty() )
+      _plan.build( *query );
+
+    _queries.push_back( query );
+  }
+
+
+  ResultCache* QueryPool::enableCache( size_t capacity )
+  {
+    if ( _cache == nullptr )
+      _cache = new ResultCache( capacity );
+
+    return _cache;
+  }
+
+
+  QueryMetrics* QueryPool::enableMetrics()
+  {
+    if ( _metrics == nullptr )
+    {
+      _metrics = new QueryMetrics();
+
+      for ( QueryVector::iterator it = _queries.begin(); it != _queries.end(); ++it )
+      {
+        (*it)->setMetrics( _metrics );
+      }
+    }
+
+    return _metrics;
+  }
+
+
+  void QueryPool::enableKeyset( const CON::Object& config )
+  {
+    _keyset.build( *_queries.front(), _name, config );
+  }
+
+
+  Query::LockType QueryPool::checkout()
+  {
+    const size_t size = _queries.size();
+    const size_t start = _next.fetch_add( 1, std::memory_order_relaxed ) % size;
+
+    for ( size_t i = 0; i < size; ++i )
+    {
+      Query* query = _queries[ ( start + i ) % size ];
+
+      if ( query->try_lock() )
+      {
+        return Query::LockType( *query, std::adopt_lock );
+      }
+    }
+
+    // Everything is busy, queue for the one we started with
+    return Query::LockType( *_queries[ start ] );
+  }
+
+}
+
@@ -0,0 +1,68 @@
+
+#include "QueryRegistry.h"
+#include "QueryPool.h"
+#include "WriteQueue.h"
+#include "ResultCache.h"
+
+
+namespace SQLW
+{
+
+  QueryRegistry::QueryRegistry( uint64_t version ) :
+    _queries(),
+    _writeQueue( nullptr ),
+    _caches( nullptr ),
+    _version( version )
+  {
+  }
+
+
+  QueryRegistry::~QueryRegistry()
+  {
+    // The queued writes use their own copies, but their loaders may refer to the pools
+    delete _writeQueue;
+
+    for ( QueryMap::iterator it = _queries.begin(); it != _queries.end(); ++it )
+    {
+      delete it->second;
+    }
+
+    delete _caches;
+  }
+
+
+  bool QueryRegistry::add( QueryPool* pool )
+  {
+    return _queries.insert( std::make_pair( pool->name(), pool ) ).second;
+  }
+
+
+  void QueryRegistry::setWriteQueue( WriteQueue* queue )
+  {
+    delete _writeQueue;
+    _writeQueue = queue;
+  }
+
+
+  CacheIndex& QueryRegistry::watchCaches()
+  {
+    if ( _caches == nullptr )
+    {
+      _caches = new CacheIndex();
+    }
+    return *_caches;
+  }
+
+
+  QueryPool* QueryRegistry::find( const std::string& name ) const
+  {
+    QueryMap::const_iterator found = _queries.find( name );
+
+    if ( found == _queries.end() )
+      return nullptr;
+    else
+      return found->second;
+  }
+
+}
+
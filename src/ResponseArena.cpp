@@ -0,0 +1,49 @@
+
+#include "ResponseArena.h"
+
+#include <algorithm>
+
+
+namespace SQLW
+{
+
+  ResponseArena::ResponseArena( size_t capacity ) :
+    _buffer( new char[ capacity ] ),
+    _capacity( capacity ),
+    _base(),
+    _allocator(),
+    _document()
+  {
+    _allocator.emplace( _buffer.get(), _capacity, _capacity, &_base );
+    _document.emplace( rapidjson::kObjectType, &*_allocator );
+  }
+
+
+  rapidjson::Document& ResponseArena::reset()
+  {
+    // Values in a memory pool are never freed one by one, so dropping the document doesn't walk it
+    _document.reset();
+
+    // The allocator's capacity only exceeds the buffer if the last response spilled. Grow to fit it
+    size_t used = _allocator->Capacity();
+    if ( used > _capacity )
+    {
+      _allocator.reset();
+      _capacity = std::max( _capacity * 2, used );
+      _buffer.reset( new char[ _capacity ] );
+    }
+
+    _allocator.emplace( _buffer.get(), _capacity, _capacity, &_base );
+    _document.emplace( rapidjson::kObjectType, &*_allocator );
+    return *_document;
+  }
+
+
+  ResponseArena& ResponseArena::local()
+  {
+    static thread_local ResponseArena arena;
+    return arena;
+  }
+
+}
+
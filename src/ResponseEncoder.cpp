@@ -0,0 +1,383 @@
+
+#include "ResponseEncoder.h"
+#include "Query.h"
+#include "KeysetPlan.h"
+
+#include <cstring>
+
+
+namespace SQLW
+{
+
+  void encodeResponse( Query& query, ResponseEncoder& encoder, const KeysetPlan* keyset )
+  {
+    const bool paged = ( keyset != nullptr && keyset->enabled() );
+    size_t rows = 0;
+
+    // True if the last row has a null key
+    bool null_key = false;
+
+    encoder.begin( query );
+
+    // Lock the database connection
+    query.prepare();
+
+    // Rows are encoded straight from sqlite's row buffer. Only the keys are copied, for the next page
+    while ( query.stepView() )
+    {
+      encoder.row( query );
+      rows += 1;
+
+      if ( paged )
+        null_key = ! keyset->record( query );
+    }
+
+    // Release the database connection
+    query.reset();
+
+    if ( query.error() )
+    {
+      encoder.end( false, query.getError(), std::string_view() );
+    }
+    else if ( paged && keyset->more( query, rows ) )
+    {
+      if ( null_key )
+        encoder.end( false, KeysetPlan::nullKeyError, std::string_view() );
+      else
+        encoder.end( true, "", keyset->encode( query ) );
+    }
+    else
+    {
+      encoder.end( true, "", std::string_view() );
+    }
+  }
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+  // MessagePack
+
+  MessagePackEncoder::MessagePackEncoder( Layout layout ) :
+    _buffer(),
+    _layout( layout ),
+    _mapHeader( 0 ),
+    _arrayHeader( 0 ),
+    _rows( 0 )
+  {
+  }
+
+
+  void MessagePackEncoder::append( const void* data, size_t size )
+  {
+    const uint8_t* bytes = static_cast< const uint8_t* >( data );
+    _buffer.insert( _buffer.end(), bytes, bytes + size );
+  }
+
+
+  void MessagePackEncoder::appendBig( uint64_t value, size_t width )
+  {
+    for ( size_t i = width; i-- > 0; )
+    {
+      _buffer.push_back( static_cast< uint8_t >( value >> ( i * 8 ) ) );
+    }
+  }
+
+
+  void MessagePackEncoder::patch32( size_t position, uint32_t value )
+  {
+    for ( size_t i = 0; i < 4; ++i )
+    {
+      _buffer[ position + i ] = static_cast< uint8_t >( value >> ( ( 3 - i ) * 8 ) );
+    }
+  }
+
+
+  void MessagePackEncoder::writeNil()
+  {
+    _buffer.push_back( 0xc0 );
+  }
+
+
+  void MessagePackEncoder::writeBool( bool value )
+  {
+    _buffer.push_back( value ? 0xc3 : 0xc2 );
+  }
+
+
+  void MessagePackEncoder::writeInt( int64_t value )
+  {
+    // The smallest form that holds the value
+    if ( value >= 0 )
+    {
+      if ( value < 128 )
+        _buffer.push_back( static_cast< uint8_t >( value ) );
+      else if ( value <= 0xff )
+      {
+        _buffer.push_back( 0xcc );
+        appendBig( value, 1 );
+      }
+      else if ( value <= 0xffff )
+      {
+        _buffer.push_back( 0xcd );
+        appendBig( value, 2 );
+      }
+      else if ( value <= 0xffffffff )
+      {
+        _buffer.push_back( 0xce );
+        appendBig( value, 4 );
+      }
+      else
+      {
+        _buffer.push_back( 0xcf );
+        appendBig( value, 8 );
+      }
+    }
+    else
+    {
+      if ( value >= -32 )
+        _buffer.push_back( static_cast< uint8_t >( value ) );
+      else if ( value >= INT8_MIN )
+      {
+        _buffer.push_back( 0xd0 );
+        appendBig( static_cast< uint64_t >( value ), 1 );
+      }
+      else if ( value >= INT16_MIN )
+      {
+        _buffer.push_back( 0xd1 );
+        appendBig( static_cast< uint64_t >( value ), 2 );
+      }
+      else if ( value >= INT32_MIN )
+      {
+        _buffer.push_back( 0xd2 );
+        appendBig( static_cast< uint64_t >( value ), 4 );
+      }
+      else
+      {
+        _buffer.push_back( 0xd3 );
+        appendBig( static_cast< uint64_t >( value ), 8 );
+      }
+    }
+  }
+
+
+  void MessagePackEncoder::writeDouble( double value )
+  {
+    uint64_t bits;
+    std::memcpy( &bits, &value, sizeof( bits ) );
+    _buffer.push_back( 0xcb );
+    appendBig( bits, 8 );
+  }
+
+
+  void MessagePackEncoder::writeString( std::string_view value )
+  {
+    const size_t size = value.size();
+    if ( size < 32 )
+      _buffer.push_back( static_cast< uint8_t >( 0xa0 | size ) );
+    else if ( size <= 0xff )
+    {
+      _buffer.push_back( 0xd9 );
+      appendBig( size, 1 );
+    }
+    else if ( size <= 0xffff )
+    {
+      _buffer.push_back( 0xda );
+      appendBig( size, 2 );
+    }
+    else
+    {
+      _buffer.push_back( 0xdb );
+      appendBig( size, 4 );
+    }
+    append( value.data(), size );
+  }
+
+
+  void MessagePackEncoder::writeBinary( std::string_view value )
+  {
+    const size_t size = value.size();
+    if ( size <= 0xff )
+    {
+      _buffer.push_back( 0xc4 );
+      appendBig( size, 1 );
+    }
+    else if ( size <= 0xffff )
+    {
+      _buffer.push_back( 0xc5 );
+      appendBig( size, 2 );
+    }
+    else
+    {
+      _buffer.push_back( 0xc6 );
+      appendBig( size, 4 );
+    }
+    append( value.data(), size );
+  }
+
+
+  void MessagePackEncoder::writeArray( uint32_t size )
+  {
+    if ( size < 16 )
+      _buffer.push_back( static_cast< uint8_t >( 0x90 | size ) );
+    else if ( size <= 0xffff )
+    {
+      _buffer.push_back( 0xdc );
+      appendBig( size, 2 );
+    }
+    else
+    {
+      _buffer.push_back( 0xdd );
+      appendBig( size, 4 );
+    }
+  }
+
+
+  void MessagePackEncoder::writeMap( uint32_t size )
+  {
+    if ( size < 16 )
+      _buffer.push_back( static_cast< uint8_t >( 0x80 | size ) );
+    else if ( size <= 0xffff )
+    {
+      _buffer.push_back( 0xde );
+      appendBig( size, 2 );
+    }
+    else
+    {
+      _buffer.push_back( 0xdf );
+      appendBig( size, 4 );
+    }
+  }
+
+
+  void MessagePackEncoder::writeColumn( const Query& query, size_t n )
+  {
+    if ( query.columnNull( n ) )
+    {
+      writeNil();
+      return;
+    }
+
+    switch( query.getColumn( n ).type() )
+    {
+      case Parameter::Text :
+        writeString( query.columnView( n ) );
+        break;
+
+      case Parameter::Blob :
+        writeBinary( query.columnView( n ) );
+        break;
+
+      case Parameter::Int :
+        writeInt( query.columnInt( n ) );
+        break;
+
+      case Parameter::Bool :
+        writeBool( query.columnInt( n ) != 0 );
+        break;
+
+      case Parameter::Double :
+        writeDouble( query.columnDouble( n ) );
+        break;
+    }
+  }
+
+
+  void MessagePackEncoder::begin( const Query& query )
+  {
+    _buffer.clear();
+    _rows = 0;
+
+    // The number of members depends on the outcome, so it's filled in at the end
+    _mapHeader = _buffer.size();
+    writeMap( 0 );
+
+    if ( _layout == Rows )
+    {
+      writeString( "columns" );
+      writeArray( query.countColumns() );
+      for ( size_t i = 0; i < query.countColumns(); ++i )
+      {
+        writeString( query.getColumn( i ).name() );
+      }
+    }
+
+    // The row count isn't known yet either, so always use the 32-bit header
+    writeString( "data" );
+    _arrayHeader = _buffer.size();
+    _buffer.push_back( 0xdd );
+    appendBig( 0, 4 );
+  }
+
+
+  void MessagePackEncoder::row( const Query& query )
+  {
+    if ( _layout == Rows )
+    {
+      writeArray( query.countColumns() );
+      for ( size_t i = 0; i < query.countColumns(); ++i )
+      {
+        writeColumn( query, i );
+      }
+    }
+    else
+    {
+      writeMap( query.countColumns() );
+      for ( size_t i = 0; i < query.countColumns(); ++i )
+      {
+        writeString( query.getColumn( i ).name() );
+        writeColumn( query, i );
+      }
+    }
+    _rows += 1;
+  }
+
+
+  void MessagePackEncoder::end( bool success, const char* error, std::string_view next )
+  {
+    // A failed response carries no rows, like the json. The data header is the last thing begin wrote
+    if ( ! success )
+    {
+      _buffer.resize( _arrayHeader + 5 );
+      _rows = 0;
+    }
+
+    patch32( _arrayHeader + 1, _rows );
+
+    writeString( "success" );
+    writeBool( success );
+
+    uint32_t members = ( _layout == Rows ? 3 : 2 );
+    if ( ! success )
+    {
+      writeString( "error" );
+      writeString( error );
+      members += 1;
+    }
+
+    if ( ! next.empty() )
+    {
+      writeString( "next" );
+      writeString( next );
+      members += 1;
+    }
+
+    // A fixmap header is a single byte
+    _buffer[ _mapHeader ] = static_cast< uint8_t >( 0x80 | members );
+  }
+
+
+  void MessagePackEncoder::fail( const char* error )
+  {
+    _buffer.clear();
+    _rows = 0;
+
+    writeMap( 3 );
+    writeString( "success" );
+    writeBool( false );
+    writeString( "error" );
+    writeString( error );
+    writeString( "data" );
+    writeArray( 0 );
+  }
+
+}
+
@@ -0,0 +1,212 @@
+
+#include "ResultCache.h"
+#include "Query.h"
+
+#include <cstring>
+
+
+namespace SQLW
+{
+
+  ResultCache::ResultCache( size_t capacity ) :
+    _capacity( capacity ),
+    _mutex(),
+    _entries(),
+    _index(),
+    _generation( 0 )
+  {
+  }
+
+
+  std::string ResultCache::makeKey( const Query& query )
+  {
+    // Fixed width values and length-prefixed strings, so different parameter sets can't collide
+    std::string key;
+    for ( size_t i = 0; i < query.countParameters(); ++i )
+    {
+      const Parameter& param = query.getParameter( i );
+      switch( param.type() )
+      {
+        case Parameter::Text :
+        case Parameter::Blob :
+          {
+            std::string_view value = param.view();
+            uint64_t size = value.size();
+            key.append( (const char*)&size, sizeof( size ) );
+            key.append( value );
+          }
+          break;
+
+        case Parameter::Int :
+          {
+            int64_t value = static_cast< int64_t >( param );
+            key.append( (const char*)&value, sizeof( value ) );
+          }
+          break;
+
+        case Parameter::Bool :
+          key.push_back( static_cast< bool >( param ) ? '1' : '0' );
+          break;
+
+        case Parameter::Double :
+          {
+            double value = static_cast< double >( param );
+            key.append( (const char*)&value, sizeof( value ) );
+          }
+          break;
+      }
+    }
+    return key;
+  }
+
+
+  ResultCache::Entry ResultCache::find( const std::string& key, uint64_t& generation )
+  {
+    std::lock_guard< std::mutex > lock( _mutex );
+    generation = _generation;
+
+    EntryMap::iterator found = _index.find( key );
+    if ( found == _index.end() )
+      return Entry();
+
+    // Move it to the front
+    _entries.splice( _entries.begin(), _entries, found->second );
+    return found->second->second;
+  }
+
+
+  void ResultCache::insert( const std::string& key, Entry entry, uint64_t generation )
+  {
+    std::lock_guard< std::mutex > lock( _mutex );
+
+    // The tables changed while the result was being read
+    if ( generation != _generation )
+      return;
+
+    EntryMap::iterator found = _index.find( key );
+    if ( found != _index.end() )
+    {
+      found->second->second = entry;
+      _entries.splice( _entries.begin(), _entries, found->second );
+      return;
+    }
+
+    _entries.push_front( std::make_pair( key, entry ) );
+    _index.insert( std::make_pair( key, _entries.begin() ) );
+
+    while ( _entries.size() > _capacity )
+    {
+      _index.erase( _entries.back().first );
+      _entries.pop_back();
+    }
+  }
+
+
+  void ResultCache::invalidate()
+  {
+    std::lock_guard< std::mutex > lock( _mutex );
+    _generation += 1;
+    _index.clear();
+    _entries.clear();
+  }
+
+
+  size_t ResultCache::size()
+  {
+    std::lock_guard< std::mutex > lock( _mutex );
+    return _entries.size();
+  }
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  CacheIndex::CacheIndex() :
+    _tables(),
+    _mutex(),
+    _pending(),
+    _dirty( false )
+  {
+  }
+
+
+  void CacheIndex::watch( const std::string& table, ResultCache* cache )
+  {
+    _tables.insert( std::make_pair( table, cache ) );
+  }
+
+
+  void CacheIndex::modified( const std::string& table )
+  {
+    // Called for every row written, so ignore anything uncached without taking the lock
+    if ( ! this->watching( table ) )
+      return;
+
+    std::lock_guard< std::mutex > lock( _mutex );
+    if ( ! _pending.empty() && _pending.back() == table )
+      return;
+
+    _pending.push_back( table );
+    _dirty.store( true, std::memory_order_release );
+  }
+
+
+  void CacheIndex::flush( sqlite3* database )
+  {
+    if ( ! _dirty.load( std::memory_order_acquire ) )
+      return;
+
+    // Wait until the changes are visible to other connections
+    if ( ! sqlite3_get_autocommit( database ) )
+      return;
+
+    TableList tables;
+    {
+      std::lock_guard< std::mutex > lock( _mutex );
+      tables.swap( _pending );
+      _dirty.store( false, std::memory_order_release );
+    }
+
+    for ( TableList::iterator it = tables.begin(); it != tables.end(); ++it )
+    {
+      std::pair< TableMap::iterator, TableMap::iterator > range = _tables.equal_range( *it );
+      for ( TableMap::iterator cit = range.first; cit != range.second; ++cit )
+      {
+        cit->second->invalidate();
+      }
+    }
+  }
+
+
+  void CacheIndex::invalidateAll()
+  {
+    for ( TableMap::iterator it = _tables.begin(); it != _tables.end(); ++it )
+    {
+      it->second->invalidate();
+    }
+  }
+
+
+  void CacheIndex::adopt( CacheIndex& other )
+  {
+    TableList tables;
+    {
+      std::lock_guard< std::mutex > lock( other._mutex );
+      tables.swap( other._pending );
+      other._dirty.store( false, std::memory_order_release );
+    }
+
+    // Only the tables this index watches are kept
+    for ( TableList::iterator it = tables.begin(); it != tables.end(); ++it )
+    {
+      this->modified( *it );
+    }
+  }
+
+
+  void CacheIndex::updateHook( void* index, int, const char*, const char* table, sqlite3_int64 )
+  {
+    static_cast< CacheIndex* >( index )->modified( table );
+  }
+
+}
+
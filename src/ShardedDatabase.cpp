@@ -0,0 +1,368 @@
+
+#include "rapidjson/document.h"
+
+#include "ShardedDatabase.h"
+#include "ThreadPool.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <memory>
+#include <future>
+
+
+namespace SQLW
+{
+
+  // Spread the bits of a key so that neighbouring keys land on different shards (the splitmix64 finaliser)
+  static uint64_t mixKey( uint64_t key )
+  {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+  }
+
+
+  ShardedDatabase::ShardedDatabase( const CON::Object& config ) :
+    _shards(),
+    _routes(),
+    _workers( nullptr )
+  {
+    const CON::Object& files = config["shards"];
+    if ( files.getSize() == 0 )
+    {
+      std::cerr << "SQLW Error - A sharded database needs at least one file in \"shards\"" << std::endl;
+      throw std::runtime_error( "No shards configured." );
+    }
+
+    const CON::Object& query_data = config["query_data"];
+    for ( size_t i = 0; i < query_data.getSize(); ++i )
+    {
+      const CON::Object query_conf = query_data[i];
+      const std::string name = query_conf["name"].asString();
+
+      Route route;
+      route.fanOut = ( query_conf.has( "fan_out" ) && query_conf["fan_out"].asInt() != 0 );
+      route.descending = false;
+
+      if ( query_conf.has( "shard_key" ) )
+      {
+        route.shardKey = query_conf["shard_key"].asString();
+
+        // The key has to be one of the parameters for the request to carry it
+        bool found = false;
+        const CON::Object& parameters = query_conf["parameters"];
+        for ( size_t p = 0; p < parameters.getSize() && ! found; ++p )
+        {
+          found = ( parameters[p]["name"].asString() == route.shardKey );
+        }
+
+        if ( ! found || route.fanOut )
+        {
+          std::cerr << "SQLW Error - Query " << name << " is routed by " << route.shardKey
+                    << ( found ? " but also fans out" : ", which is not one of its parameters" ) << std::endl;
+          throw std::runtime_error( "Invalid shard key." );
+        }
+      }
+
+      if ( query_conf.has( "merge_key" ) )
+      {
+        route.mergeKey = query_conf["merge_key"].asString();
+      }
+
+      if ( query_conf.has( "merge_order" ) )
+      {
+        std::string order = query_conf["merge_order"].asString();
+        if ( order == "desc" )
+          route.descending = true;
+        else if ( order != "asc" )
+        {
+          std::cerr << "SQLW Error - Unknown merge order for query " << name << ": " << order << ". Expected asc or desc" << std::endl;
+          throw std::runtime_error( "Unknown merge order." );
+        }
+      }
+
+      if ( ! route.mergeKey.empty() && ! route.fanOut )
+      {
+        std::cerr << "SQLW Error - Query " << name << " has a merge key but does not fan out" << std::endl;
+        throw std::runtime_error( "Merge key without fan out." );
+      }
+
+      // Each shard's page would end on a different row, so no one token could resume them all
+      if ( route.fanOut && query_conf.has( "keyset" ) )
+      {
+        std::cerr << "SQLW Error - Query " << name << " is paged with a keyset, so can't fan out" << std::endl;
+        throw std::runtime_error( "Keyset with fan out." );
+      }
+
+      if ( route.fanOut || ! route.shardKey.empty() )
+      {
+        _routes.insert( std::make_pair( name, route ) );
+      }
+    }
+
+    try
+    {
+      for ( size_t i = 0; i < files.getSize(); ++i )
+      {
+        _shards.push_back( new Database( config, files[i].asString() ) );
+      }
+
+      if ( _shards.size() > 1 )
+      {
+        _workers = new ThreadPool( _shards.size() - 1 );
+      }
+    }
+    catch ( ... )
+    {
+      // The destructor won't run, so close the shards opened so far
+      this->close();
+      throw;
+    }
+  }
+
+
+  ShardedDatabase::~ShardedDatabase()
+  {
+    this->close();
+  }
+
+
+  void ShardedDatabase::close()
+  {
+    // Finish any fan-out requests before their shards go
+    delete _workers;
+    _workers = nullptr;
+
+    for ( ShardVector::iterator it = _shards.begin(); it != _shards.end(); ++it )
+    {
+      delete (*it);
+    }
+    _shards.clear();
+  }
+
+
+  size_t ShardedDatabase::shardFor( int64_t key ) const
+  {
+    return mixKey( static_cast< uint64_t >( key ) ) % _shards.size();
+  }
+
+
+  size_t ShardedDatabase::shardFor( std::string_view key ) const
+  {
+    // FNV-1a, which is fixed, unlike std::hash, so keys stay on their shard across builds
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for ( std::string_view::const_iterator it = key.begin(); it != key.end(); ++it )
+    {
+      hash ^= static_cast< uint8_t >( *it );
+      hash *= 0x100000001b3ULL;
+    }
+
+    return mixKey( hash ) % _shards.size();
+  }
+
+
+  const ShardedDatabase::Route* ShardedDatabase::route( const char* name ) const
+  {
+    RouteMap::const_iterator found = _routes.find( name );
+
+    if ( found == _routes.end() )
+      return nullptr;
+    else
+      return &found->second;
+  }
+
+
+  void ShardedDatabase::submit( std::function< void() > job )
+  {
+    _workers->submit( std::move( job ) );
+  }
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+  // RapidJson Library
+
+  // Order two values of the merge column. Null or missing values come first, then numbers, then strings
+  static int compareValues( const rapidjson::Value* a, const rapidjson::Value* b )
+  {
+    int rank_a = ( a == nullptr || a->IsNull() ? 0 : ( a->IsNumber() ? 1 : 2 ) );
+    int rank_b = ( b == nullptr || b->IsNull() ? 0 : ( b->IsNumber() ? 1 : 2 ) );
+
+    if ( rank_a != rank_b )
+      return rank_a < rank_b ? -1 : 1;
+
+    if ( rank_a == 0 )
+      return 0;
+
+    if ( rank_a == 1 )
+    {
+      if ( a->IsInt64() && b->IsInt64() )
+        return ( a->GetInt64() < b->GetInt64() ? -1 : ( b->GetInt64() < a->GetInt64() ? 1 : 0 ) );
+      else
+        return ( a->GetDouble() < b->GetDouble() ? -1 : ( b->GetDouble() < a->GetDouble() ? 1 : 0 ) );
+    }
+
+    if ( ! a->IsString() || ! b->IsString() )
+      return 0;
+
+    return std::string_view( a->GetString(), a->GetStringLength() ).compare( std::string_view( b->GetString(), b->GetStringLength() ) );
+  }
+
+
+  // Return the member of a row, or null if it isn't there
+  static const rapidjson::Value* findColumn( const rapidjson::Value& row, const std::string& column )
+  {
+    if ( ! row.IsObject() )
+      return nullptr;
+
+    rapidjson::Value::ConstMemberIterator found = row.FindMember( column.c_str() );
+    if ( found == row.MemberEnd() )
+      return nullptr;
+    else
+      return &found->value;
+  }
+
+
+  rapidjson::Document executeJson( ShardedDatabase& db, const char* name, const rapidjson::Document& data )
+  {
+    const ShardedDatabase::Route* route = db.route( name );
+
+    // Unrouted queries, including unknown ones, are answered by the first shard
+    if ( route == nullptr )
+    {
+      return executeJson( db.shard( 0 ), name, data );
+    }
+
+    if ( ! route->fanOut )
+    {
+      const rapidjson::Value* key = findColumn( data, route->shardKey );
+      if ( key != nullptr && key->IsInt64() )
+        return executeJson( db.shard( db.shardFor( key->GetInt64() ) ), name, data );
+      else if ( key != nullptr && key->IsString() )
+        return executeJson( db.shard( db.shardFor( std::string_view( key->GetString(), key->GetStringLength() ) ) ), name, data );
+
+      std::string err_string( "Invalid request parameter: " );
+      err_string += route->shardKey;
+
+      rapidjson::Document response( rapidjson::kObjectType );
+      rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+      response.AddMember( "success", false, alloc );
+      response.AddMember( "error", rapidjson::Value( err_string.c_str(), alloc ), alloc );
+      response.AddMember( "data", rapidjson::Value( rapidjson::kArrayType ), alloc );
+      return response;
+    }
+
+    // Scatter to the other shards and run the first here
+    const size_t count = db.size();
+    std::vector< rapidjson::Document > responses( count );
+    std::vector< std::future< void > > pending;
+
+    for ( size_t i = 1; i < count; ++i )
+    {
+      std::shared_ptr< std::packaged_task< void() > > job = std::make_shared< std::packaged_task< void() > >( [&db, &responses, &data, name, i]()
+        {
+          responses[i] = executeJson( db.shard( i ), name, data );
+        } );
+
+      pending.push_back( job->get_future() );
+      db.submit( [job]() { (*job)(); } );
+    }
+
+    std::exception_ptr error;
+    try
+    {
+      responses[0] = executeJson( db.shard( 0 ), name, data );
+    }
+    catch ( ... )
+    {
+      error = std::current_exception();
+    }
+
+    // Every job refers to this frame, so wait for them all before throwing
+    for ( std::vector< std::future< void > >::iterator it = pending.begin(); it != pending.end(); ++it )
+    {
+      try
+      {
+        it->get();
+      }
+      catch ( ... )
+      {
+        if ( ! error )
+          error = std::current_exception();
+      }
+    }
+
+    if ( error )
+      std::rethrow_exception( error );
+
+    // Gather
+    for ( size_t i = 0; i < count; ++i )
+    {
+      if ( ! responses[i]["success"].GetBool() )
+        return std::move( responses[i] );
+    }
+
+    rapidjson::Document response( rapidjson::kObjectType );
+    rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+    rapidjson::Value rows( rapidjson::kArrayType );
+
+    if ( route->mergeKey.empty() )
+    {
+      for ( size_t i = 0; i < count; ++i )
+      {
+        const rapidjson::Value& shard_rows = responses[i]["data"];
+        for ( rapidjson::Value::ConstValueIterator it = shard_rows.Begin(); it != shard_rows.End(); ++it )
+        {
+          rows.PushBack( rapidjson::Value( *it, alloc ), alloc );
+        }
+      }
+    }
+    else
+    {
+      // Each shard's rows are already in order, so repeatedly take the first of the shards' next rows.
+      // Ties go to the lower shard
+      std::vector< rapidjson::SizeType > next( count, 0 );
+      while ( true )
+      {
+        size_t best = count;
+        const rapidjson::Value* best_key = nullptr;
+
+        for ( size_t i = 0; i < count; ++i )
+        {
+          const rapidjson::Value& shard_rows = responses[i]["data"];
+          if ( next[i] >= shard_rows.Size() )
+            continue;
+
+          const rapidjson::Value* key = findColumn( shard_rows[ next[i] ], route->mergeKey );
+          if ( best == count )
+          {
+            best = i;
+            best_key = key;
+            continue;
+          }
+
+          int order = compareValues( key, best_key );
+          if ( route->descending ? order > 0 : order < 0 )
+          {
+            best = i;
+            best_key = key;
+          }
+        }
+
+        if ( best == count )
+          break;
+
+        rows.PushBack( rapidjson::Value( responses[best]["data"][ next[best] ], alloc ), alloc );
+        next[best] += 1;
+      }
+    }
+
+    response.AddMember( "success", true, alloc );
+    response.AddMember( "data", rows, alloc );
+    return response;
+  }
+
+}
+
@@ -0,0 +1,68 @@
+
+#include "ThreadPool.h"
+
+
+namespace SQLW
+{
+
+  ThreadPool::ThreadPool( size_t number ) :
+    _mutex(),
+    _condition(),
+    _jobs(),
+    _stop( false ),
+    _threads()
+  {
+    for ( size_t i = 0; i < number; ++i )
+    {
+      _threads.push_back( std::thread( &ThreadPool::run, this ) );
+    }
+  }
+
+
+  ThreadPool::~ThreadPool()
+  {
+    {
+      std::lock_guard< std::mutex > lock( _mutex );
+      _stop = true;
+    }
+    _condition.notify_all();
+
+    for ( ThreadVector::iterator it = _threads.begin(); it != _threads.end(); ++it )
+    {
+      it->join();
+    }
+  }
+
+
+  void ThreadPool::submit( Job job )
+  {
+    {
+      std::lock_guard< std::mutex > lock( _mutex );
+      _jobs.push_back( std::move( job ) );
+    }
+    _condition.notify_one();
+  }
+
+
+  void ThreadPool::run()
+  {
+    std::unique_lock< std::mutex > lock( _mutex );
+    while ( true )
+    {
+      _condition.wait( lock, [this]() { return _stop || ! _jobs.empty(); } );
+
+      // Only stop once everything has run
+      if ( _jobs.empty() )
+        break;
+
+      Job job = std::move( _jobs.front() );
+      _jobs.pop_front();
+
+      lock.unlock();
+      job();
+      lock.lock();
+    }
+  }
+
+}
+
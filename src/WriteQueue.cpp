@@ -0,0 +1,229 @@
+
+#include "WriteQueue.h"
+#include "Database.h"
+
+#include <iostream>
+
+
+namespace SQLW
+{
+
+  WriteQueue::WriteQueue( Connection& con, const CON::Object& query_data, const CON::Object& config ) :
+    _connection( con ),
+    _queries(),
+    _capacity( 1024 ),
+    _maxBatch( 256 ),
+    _maxDelay( 1000 ),
+    _mutex(),
+    _notEmpty(),
+    _notFull(),
+    _items(),
+    _stop( false ),
+    _thread()
+  {
+    if ( config.has( "capacity" ) )
+    {
+      _capacity = config["capacity"].asInt();
+    }
+
+    if ( config.has( "max_batch" ) )
+    {
+      _maxBatch = config["max_batch"].asInt();
+    }
+
+    if ( config.has( "max_delay_us" ) )
+    {
+      _maxDelay = std::chrono::microseconds( config["max_delay_us"].asInt() );
+    }
+
+    if ( _capacity == 0 || _maxBatch == 0 )
+    {
+      std::cerr << "SQLW Error - Write queue capacity and max_batch must be greater than zero." << std::endl;
+      throw std::runtime_error( "Invalid write queue configuration." );
+    }
+
+    // Prepare a private copy of every query that writes
+    try
+    {
+      for ( size_t i = 0; i < query_data.getSize(); ++i )
+      {
+        const CON::Object query_conf = query_data[i];
+
+        Query* q = new Query( _connection, query_conf );
+        if ( q->readOnly() )
+        {
+          delete q;
+          continue;
+        }
+
+        _queries.insert( std::make_pair( query_conf["name"].asString(), q ) );
+      }
+    }
+    catch ( ... )
+    {
+      for ( QueryMap::iterator it = _queries.begin(); it != _queries.end(); ++it )
+      {
+        delete it->second;
+      }
+      throw;
+    }
+
+    _thread = std::thread( &WriteQueue::run, this );
+  }
+
+
+  WriteQueue::~WriteQueue()
+  {
+    {
+      std::lock_guard< std::mutex > lock( _mutex );
+      _stop = true;
+    }
+    _notEmpty.notify_one();
+    _thread.join();
+
+    for ( QueryMap::iterator it = _queries.begin(); it != _queries.end(); ++it )
+    {
+      delete it->second;
+    }
+    _queries.clear();
+  }
+
+
+  std::future< Status > WriteQueue::push( const char* name, Query::Loader loader )
+  {
+    std::promise< Status > promise;
+    std::future< Status > future = promise.get_future();
+
+    QueryMap::iterator found = _queries.find( name );
+    if ( found == _queries.end() )
+    {
+      promise.set_value( Status{ false, "Invalid request. Not a queued write." } );
+      return future;
+    }
+
+    {
+      std::unique_lock< std::mutex > lock( _mutex );
+      _notFull.wait( lock, [this]() { return _items.size() < _capacity; } );
+
+      _items.push_back( Item{ found->second, std::move( loader ), std::move( promise ) } );
+    }
+    _notEmpty.notify_one();
+
+    return future;
+  }
+
+
+  void WriteQueue::run()
+  {
+    ItemVector batch;
+    batch.reserve( _maxBatch );
+
+    std::unique_lock< std::mutex > lock( _mutex );
+    while ( true )
+    {
+      _notEmpty.wait( lock, [this]() { return _stop || ! _items.empty(); } );
+
+      // Only stop once everything has been committed
+      if ( _items.empty() )
+        break;
+
+      // Give other writers a moment to join the transaction
+      std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + _maxDelay;
+      _notEmpty.wait_until( lock, deadline, [this]() { return _stop || _items.size() >= _maxBatch; } );
+
+      while ( ! _items.empty() && batch.size() < _maxBatch )
+      {
+        batch.push_back( std::move( _items.front() ) );
+        _items.pop_front();
+      }
+
+      lock.unlock();
+      _notFull.notify_all();
+
+      this->commit( batch );
+      batch.clear();
+
+      lock.lock();
+    }
+  }
+
+
+  void WriteQueue::commit( ItemVector& batch )
+  {
+    std::vector< Status > results( batch.size(), Status{ false, "" } );
+    const char* error = nullptr;
+
+    {
+      std::lock_guard< std::mutex > connection_lock( _connection.mutex );
+
+      if ( ! transaction( _connection, "BEGIN IMMEDIATE;" ) )
+      {
+        error = "Failed to begin write transaction.";
+      }
+      else
+      {
+        for ( size_t i = 0; i < batch.size(); ++i )
+        {
+          Query& query = *batch[i].query;
+
+          bool loaded = false;
+          try
+          {
+            loaded = batch[i].loader( query );
+          }
+          catch ( std::exception& ex )
+          {
+            std::cerr << "SQLW Error - Exception while loading queued write: " << ex.what() << std::endl;
+          }
+
+          if ( ! loaded )
+          {
+            results[i].error = "Invalid request parameters.";
+            continue;
+          }
+
+          query.execute( results[i] );
+
+          // Some errors (e.g. disk full) roll back the whole transaction, not just the statement
+          if ( ! results[i].success && sqlite3_get_autocommit( _connection.database ) )
+          {
+            break;
+          }
+        }
+
+        if ( sqlite3_get_autocommit( _connection.database ) )
+        {
+          error = "Write transaction was rolled back.";
+        }
+        else if ( ! transaction( _connection, "COMMIT;" ) )
+        {
+          transaction( _connection, "ROLLBACK;" );
+          error = "Failed to commit write transaction.";
+        }
+      }
+    }
+
+    // Only report back once the outcome is durable
+    for ( size_t i = 0; i < batch.size(); ++i )
+    {
+      if ( error != nullptr )
+      {
+        results[i].success = false;
+        results[i].error = error;
+      }
+      batch[i].promise.set_value( std::move( results[i] ) );
+    }
+  }
+
+
+  void WriteQueue::setMetrics( const std::string& name, QueryMetrics* metrics )
+  {
+    QueryMap::iterator found = _queries.find( name );
+    if ( found != _queries.end() )
+    {
+      found->second->setMetrics( metrics );
+    }
+  }
+
+}
+
@@ -10,6 +10,12 @@ CREATE TABLE "Devices"
   DeviceDescription TEXT not NULL
 );
 
+CREATE TABLE "Blobs"
+(
+  BlobIndex INTEGER PRIMARY KEY,
+  BlobData BLOB not NULL
+);
+
 
 INSERT INTO Devices( DeviceIndex, DeviceIdentifier, DeviceType, DeviceName, DeviceDescription )
   VALUES